@@ -0,0 +1,124 @@
+#include "battery.h"
+
+static const int8_t ALARM_THRESHOLDS[] = {20, 10, 0};  // Highest first
+static const size_t ALARM_COUNT = sizeof(ALARM_THRESHOLDS) / sizeof(ALARM_THRESHOLDS[0]);
+
+// ==================== BatteryAlarm ====================
+int8_t BatteryAlarm::update(uint8_t level) {
+  // Re-arm thresholds the level has recovered from
+  while (alerted != NONE && level >= alerted + BATTERY_HYSTERESIS) {
+    int8_t higher = NONE;
+    for (size_t i = 0; i < ALARM_COUNT; i++) {
+      if (ALARM_THRESHOLDS[i] > alerted) higher = ALARM_THRESHOLDS[i];
+    }
+    alerted = higher;
+  }
+
+  // Lowest threshold the level is at or below
+  int8_t crossed = NONE;
+  for (size_t i = 0; i < ALARM_COUNT; i++) {
+    if (level <= ALARM_THRESHOLDS[i]) crossed = ALARM_THRESHOLDS[i];
+  }
+
+  if (crossed != NONE && (alerted == NONE || crossed < alerted)) {
+    alerted = crossed;
+    return crossed;
+  }
+  return NONE;
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <algorithm>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+static esp_adc_cal_characteristics_t adcChars;
+static uint8_t dmaBuffer[BATTERY_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES];
+
+// ==================== BatteryMonitor ====================
+BatteryMonitor::BatteryMonitor()
+    : pin(0), dmaReady(false), filteredMv(0), cachedLevel(0), pendingAlert(BatteryAlarm::NONE), lastSample(0) {}
+
+void BatteryMonitor::begin(uint8_t batteryPin) {
+  pin = batteryPin;
+  int8_t channel = digitalPinToAnalogChannel(pin);
+  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &adcChars);
+
+  // Continuous mode on ADC1 only, drained one burst at a time
+  adc_digi_init_config_t initConfig = {};
+  initConfig.max_store_buf_size = sizeof(dmaBuffer) * 2;
+  initConfig.conv_num_each_intr = sizeof(dmaBuffer);
+  initConfig.adc1_chan_mask = BIT(channel);
+  initConfig.adc2_chan_mask = 0;
+
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_11;
+  pattern.channel = channel;
+  pattern.unit = 0;  // ADC1
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  adc_digi_configuration_t digiConfig = {};
+  digiConfig.conv_limit_en = false;
+  digiConfig.conv_limit_num = 250;
+  digiConfig.pattern_num = 1;
+  digiConfig.adc_pattern = &pattern;
+  digiConfig.sample_freq_hz = 20 * 1000;
+  digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digiConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+  dmaReady = channel >= 0 && adc_digi_initialize(&initConfig) == ESP_OK &&
+             adc_digi_controller_configure(&digiConfig) == ESP_OK;
+  if (!dmaReady) Serial.println("[Battery] DMA ADC unavailable, using oneshot reads");
+
+  lastSample = millis() - BATTERY_SAMPLE_INTERVAL;  // First update() samples immediately
+}
+
+// Median of one burst, in calibrated millivolts at the ADC pin
+bool BatteryMonitor::sampleBurst(uint32_t &pinMv) {
+  static uint16_t raw[BATTERY_BURST_SAMPLES];
+  size_t count = 0;
+
+  if (dmaReady) {
+    uint32_t length = 0;
+    adc_digi_start();
+    esp_err_t err = adc_digi_read_bytes(dmaBuffer, sizeof(dmaBuffer), &length, 50);
+    adc_digi_stop();
+    if (err == ESP_OK) {
+      for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *result = (adc_digi_output_data_t *)&dmaBuffer[i];
+        if (result->type2.unit == 0) raw[count++] = result->type2.data;
+      }
+    }
+  } else {
+    for (; count < BATTERY_BURST_SAMPLES; count++) raw[count] = analogRead(pin);
+  }
+
+  if (count == 0) return false;
+  std::nth_element(raw, raw + count / 2, raw + count);
+  pinMv = esp_adc_cal_raw_to_voltage(raw[count / 2], &adcChars);
+  return true;
+}
+
+bool BatteryMonitor::update() {
+  if (millis() - lastSample < BATTERY_SAMPLE_INTERVAL) return false;
+  lastSample = millis();
+
+  uint32_t pinMv;
+  if (!sampleBurst(pinMv)) return false;
+
+  float batteryMv = pinMv * BATTERY_DIVIDER_RATIO;
+  filteredMv = (filteredMv == 0) ? batteryMv : filteredMv + BATTERY_EMA_ALPHA * (batteryMv - filteredMv);
+  cachedLevel = socFromCentivolts((int)(filteredMv / 10));
+
+  int8_t crossed = alarm.update(cachedLevel);
+  if (crossed != BatteryAlarm::NONE) pendingAlert = crossed;
+  return true;
+}
+
+int8_t BatteryMonitor::takeAlert() {
+  int8_t alert = pendingAlert;
+  pendingAlert = BatteryAlarm::NONE;
+  return alert;
+}
+#endif  // ARDUINO
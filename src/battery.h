@@ -0,0 +1,77 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATTERY_DIVIDER_RATIO (12.0f / 3.3f)  // Adjust for your voltage divider
+#define BATTERY_SAMPLE_INTERVAL 60000UL        // 1 minute between DMA bursts
+#define BATTERY_BURST_SAMPLES 64               // Conversions per burst, median filtered
+#define BATTERY_EMA_ALPHA 0.2f                 // Weight of the newest burst
+#define BATTERY_HYSTERESIS 5                   // % above a threshold before it re-arms
+
+// Resting voltage of a 3S pack against state of charge, ascending
+struct SocPoint {
+  uint16_t centivolts;
+  uint8_t percent;
+};
+
+constexpr SocPoint SOC_TABLE[] = {
+    {1050, 0},  {1131, 10}, {1158, 20}, {1175, 30}, {1190, 40},  {1206, 50},
+    {1220, 60}, {1232, 70}, {1242, 80}, {1250, 90}, {1260, 100},
+};
+constexpr size_t SOC_TABLE_LEN = sizeof(SOC_TABLE) / sizeof(SOC_TABLE[0]);
+
+// Linear interpolation between the two table points around cv
+constexpr uint8_t socFromCentivolts(int cv, size_t i = 1) {
+  return cv <= SOC_TABLE[0].centivolts ? SOC_TABLE[0].percent
+         : i >= SOC_TABLE_LEN          ? SOC_TABLE[SOC_TABLE_LEN - 1].percent
+         : cv <= SOC_TABLE[i].centivolts
+             ? SOC_TABLE[i - 1].percent + (cv - SOC_TABLE[i - 1].centivolts) *
+                                              (SOC_TABLE[i].percent - SOC_TABLE[i - 1].percent) /
+                                              (SOC_TABLE[i].centivolts - SOC_TABLE[i - 1].centivolts)
+             : socFromCentivolts(cv, i + 1);
+}
+
+static_assert(socFromCentivolts(1000) == 0, "Below table clamps to empty");
+static_assert(socFromCentivolts(1300) == 100, "Above table clamps to full");
+static_assert(socFromCentivolts(1206) == 50, "Table points map exactly");
+static_assert(socFromCentivolts(1246) == 85, "Between points interpolates");
+
+// Low battery thresholds, highest first. Each fires once on the way down and
+// re-arms only after the level recovers BATTERY_HYSTERESIS above it.
+class BatteryAlarm {
+public:
+  static const int8_t NONE = -1;
+
+  BatteryAlarm() : alerted(NONE) {}
+  int8_t update(uint8_t level);  // Returns the threshold just crossed, or NONE
+
+private:
+  int8_t alerted;  // Lowest threshold already notified
+};
+
+class BatteryMonitor {
+public:
+  BatteryMonitor();
+
+  void begin(uint8_t pin);
+  bool update();  // Samples when due, returns true on a new reading
+
+  uint8_t level() const { return cachedLevel; }
+  uint16_t millivolts() const { return (uint16_t)filteredMv; }
+  int8_t takeAlert();  // Threshold crossed by the latest reading, consumed once
+
+private:
+  bool sampleBurst(uint32_t &pinMv);
+
+  uint8_t pin;
+  bool dmaReady;
+  float filteredMv;
+  uint8_t cachedLevel;
+  int8_t pendingAlert;
+  unsigned long lastSample;
+  BatteryAlarm alarm;
+};
+
+#endif  // BATTERY_H
@@ -1,6 +1,13 @@
 #include "ble_server.h"
+#include "credentials.h"
+#include "heap_accounting.h"
+#include "json_pool.h"
+#include "power_manager.h"
 #include <Preferences.h>
 #include <Wifi.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
@@ -10,17 +17,25 @@ static void wifiScanTask(void *parameter);
 // ==================== BLECommissioningServer ====================
 BLECommissioningServer::BLECommissioningServer()
     : pServer(nullptr), pRxCharacteristic(nullptr), pTxCharacteristic(nullptr), deviceConnected(false),
-      payloadReceived(false) {}
+      payloadReceived(false), ipReceivedAck(false), wire(WireFormat::Json), proximity(false), keys(), enrolledMask(0),
+      lock(nullptr), nonce(0), nonceAt(0), unlockPending(false), unlocks(0), rejected(0), idleDrops(0), connectedAt(0),
+      connectUs(0), verifiedUs(0), advertisingSinceUs(0), advertisingUs(0), proximitySinceUs(0), connectToVerify(), verifyToSolenoid(), connectToSolenoid() {}
 
 BLECommissioningServer::~BLECommissioningServer() { end(); }
 
 void BLECommissioningServer::end() {
+  if (!pServer) return;
   sendResponse("{\"status\":\"disconnected\"}");
   pServer->getAdvertising()->stop();
   BLEDevice::deinit();
+  pServer = nullptr;
+  pRxCharacteristic = nullptr;
+  pTxCharacteristic = nullptr;
+  proximity = false;
 }
 
 void BLECommissioningServer::begin(const char *deviceName) {
+  wire = WireFormat::Json;
   BLEDevice::init(deviceName);
   BLEDevice::setMTU(517);
 
@@ -54,7 +69,9 @@ void BLECommissioningServer::begin(const char *deviceName) {
 void BLECommissioningServer::sendResponse(const String &response) {
   if (!pTxCharacteristic) return;
 
-  pTxCharacteristic->setValue(response.c_str());
+  WireFormat format = wire;
+  String encoded = wireTranscode(response, format);
+  pTxCharacteristic->setValue((uint8_t *)encoded.c_str(), encoded.length());
   pTxCharacteristic->notify();
 
   Serial.println("[BLE] Response sent: " + response);
@@ -68,6 +85,12 @@ bool BLECommissioningServer::hasReceivedIPAck() { return ipReceivedAck; }
 
 // ==================== ServerCallbacks ====================
 void ServerCallbacks::onConnect(BLEServer *pServer) {
+  if (bleServer->proximity) {
+    int64_t now = esp_timer_get_time();
+    bleServer->connectUs = now;
+    bleServer->connectedAt = millis();
+    bleServer->advertisingUs += now - bleServer->advertisingSinceUs;
+  }
   bleServer->deviceConnected = true;
   Serial.println("[BLE] Client connected");
 }
@@ -75,6 +98,7 @@ void ServerCallbacks::onConnect(BLEServer *pServer) {
 void ServerCallbacks::onDisconnect(BLEServer *pServer) {
   bleServer->deviceConnected = false;
   Serial.println("[BLE] Client disconnected");
+  if (bleServer->proximity) bleServer->advertisingSinceUs = esp_timer_get_time();
   pServer->getAdvertising()->start();
 }
 
@@ -140,17 +164,21 @@ static void wifiScanTask(void *parameter) {
 
 // ==================== RxCharacteristicCallbacks ====================
 void RxCharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic) {
-  std::string rxValue = pCharacteristic->getValue();
+  HEAP_SCOPE(BLE);
+  // Parse straight from the characteristic buffer instead of copying it into a String
+  const uint8_t *rxData = pCharacteristic->getData();
+  size_t rxLength = pCharacteristic->getLength();
 
-  if (rxValue.length() == 0) return;
+  if (rxLength == 0) return;
 
-  String payload = String((const char *)rxValue.c_str());
-  Serial.println("[BLE] Received payload:");
-  Serial.println(payload);
+  // Apps that write MessagePack get MessagePack responses, older apps keep JSON
+  bleServer->wire = wireDetect(rxData, rxLength);
+  Serial.println("[BLE] Received " + String(wireFormatName(bleServer->wire)) + " payload: " + String(rxLength) +
+                 " bytes");
 
-  // Parse and validate JSON
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, payload);
+  // Parse and validate the payload
+  PooledJsonDocument doc;
+  DeserializationError error = wireDecode(doc, rxData, rxLength, bleServer->wire, WireMessage::Commissioning);
 
   if (error) {
     bleServer->sendResponse("{\"error\":\"JSON parse error\"}");
@@ -158,13 +186,13 @@ void RxCharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic) {
     return;
   }
 
-  if(doc["status"] && doc["status"].as<String>().equals("ip_ack")) {
+  if (doc["status"] == "ip_ack") {
     bleServer->ipReceivedAck = true;
     Serial.println("[BLE] Received IP acknowledgment from app.");
     return;
   }
 
-  if (doc["request"] && doc["request"].as<String>().equals("wifi_networks")) {
+  if (doc["request"] == "wifi_networks") {
     // Check if a scan is already in progress
     if (wifiScanTaskHandle != nullptr) {
       bleServer->sendResponse("{\"error\":\"Scan already in progress\"}");
@@ -197,21 +225,21 @@ void RxCharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic) {
 
   Preferences prefs;
   prefs.begin("my_storage", false);
-  if (!doc["pairing_code"].as<String>().equals(prefs.getString("pairing_code"))) {
+  if (!prefs.getString("pairing_code").equals(doc["pairing_code"] | "")) {
     bleServer->sendResponse("{\"error\":\"Invalid pairing code\"}");
     Serial.println("[BLE] Invalid pairing code");
     return;
   }
 
   // Store in NVS
-  prefs.putString("user_id", doc["user_id"].as<String>());
-  prefs.putString("wifi_ssid", doc["wifi_ssid"].as<String>());
-  prefs.putString("wifi_pwd", doc["wifi_pwd"].as<String>());
-  prefs.putString("lock_name", doc["lock_name"].as<String>());
-  prefs.putString("owner", doc["owner"].as<String>());
-  prefs.putString("token", doc["token"].as<String>());
-  prefs.putString("pin", doc["pin"].as<String>());
+  prefs.putString("user_id", doc["user_id"] | "");
+  prefs.putString("wifi_ssid", doc["wifi_ssid"] | "");
+  prefs.putString("wifi_pwd", doc["wifi_pwd"] | "");
+  prefs.putString("lock_name", doc["lock_name"] | "");
+  prefs.putString("owner", doc["owner"] | "");
+  prefs.putString("token", doc["token"] | "");
   prefs.end();
+  credentials.setPin(doc["pin"] | "");  // Stored as a salted verifier, never in plaintext
 
   // Send acknowledgment via TX characteristic
   String ack = "{\"status\":\"received\"}";
@@ -220,3 +248,208 @@ void RxCharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic) {
   bleServer->payloadReceived = true;
   Serial.println("[BLE] Credentials stored successfully");
 }
+
+// ==================== Proximity unlock ====================
+static void recordLatency(ProximityLatency &latency, int64_t us) {
+  latency.count++;
+  latency.totalUs += us;
+  if ((uint32_t)us > latency.maxUs) latency.maxUs = us;
+}
+
+static String latencyJson(const ProximityLatency &latency) {
+  return "{\"count\":" + String(latency.count) +
+         ",\"avg_us\":" + String(latency.count ? (uint32_t)(latency.totalUs / latency.count) : 0) +
+         ",\"max_us\":" + String(latency.maxUs) + "}";
+}
+
+void BLECommissioningServer::loadKeys() {
+  Preferences prefs;
+  prefs.begin(PROXIMITY_NAMESPACE, true);
+  enrolledMask = prefs.getUChar("mask", 0);
+  if (prefs.getBytes("keys", keys, sizeof(keys)) != sizeof(keys)) enrolledMask = 0;
+  prefs.end();
+}
+
+static void saveKeys(const uint8_t *keys, size_t length, uint8_t mask) {
+  Preferences prefs;
+  prefs.begin(PROXIMITY_NAMESPACE, false);
+  prefs.putBytes("keys", keys, length);
+  prefs.putUChar("mask", mask);
+  prefs.end();
+}
+
+bool BLECommissioningServer::proximityEnrolled() {
+  if (!proximity) loadKeys();
+  return enrolledMask != 0;
+}
+
+// Enrolment runs on loop() while the BLE task may be verifying a write against the same keys
+int BLECommissioningServer::enrollPhone(uint8_t *key) {
+  if (!lock) lock = xSemaphoreCreateMutex();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!proximity) loadKeys();
+  int enrolled = -1;
+  for (uint8_t slot = 0; slot < PROXIMITY_PHONES; slot++) {
+    if (enrolledMask & (1 << slot)) continue;
+    esp_fill_random(keys[slot], PROXIMITY_KEY_LEN);
+    memcpy(key, keys[slot], PROXIMITY_KEY_LEN);
+    enrolledMask |= 1 << slot;
+    saveKeys(&keys[0][0], sizeof(keys), enrolledMask);
+    enrolled = slot;
+    break;
+  }
+  xSemaphoreGive(lock);
+  return enrolled;
+}
+
+bool BLECommissioningServer::removePhone(uint8_t slot) {
+  if (!lock) lock = xSemaphoreCreateMutex();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!proximity) loadKeys();
+  bool removed = slot < PROXIMITY_PHONES && (enrolledMask & (1 << slot));
+  if (removed) {
+    enrolledMask &= ~(1 << slot);
+    memset(keys[slot], 0, PROXIMITY_KEY_LEN);
+    saveKeys(&keys[0][0], sizeof(keys), enrolledMask);
+  }
+  xSemaphoreGive(lock);
+  return removed;
+}
+
+bool BLECommissioningServer::beginProximity(const char *deviceName) {
+  if (proximity) return true;
+  loadKeys();
+  if (!enrolledMask) return false;
+
+  if (!lock) lock = xSemaphoreCreateMutex();
+  BLEDevice::init(deviceName);
+  BLEDevice::setPower(ESP_PWR_LVL_N0);  // Proximity only, a short range also cuts TX current
+
+  pServer = BLEDevice::createServer();
+  pServer->setCallbacks(new ServerCallbacks(this));
+
+  // No MTU bump, notify characteristic or scan response: the unlock write fits the default MTU
+  BLEService *proximityService = pServer->createService(PROXIMITY_SERVICE_UUID);
+  BLECharacteristic *unlockCharacteristic =
+      proximityService->createCharacteristic(UNLOCK_CHAR_UUID, BLECharacteristic::PROPERTY_WRITE_NR);
+  unlockCharacteristic->setCallbacks(new UnlockCharacteristicCallbacks(this));
+  proximityService->start();
+
+  BLEAdvertising *pAdvertising = pServer->getAdvertising();
+  pAdvertising->setMinInterval(PROXIMITY_ADV_INTERVAL_MS * 8 / 5);  // 0.625 ms units
+  pAdvertising->setMaxInterval(PROXIMITY_ADV_INTERVAL_MS * 8 / 5);
+  proximity = true;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  rotateNonce();
+  xSemaphoreGive(lock);
+  pAdvertising->start();
+
+  proximitySinceUs = advertisingSinceUs = esp_timer_get_time();
+  advertisingUs = 0;
+  Serial.println("[BLE] Proximity unlock advertising - Device: " + String(deviceName));
+  return true;
+}
+
+// Challenge goes out in the manufacturer data: company ID then the nonce, little endian
+void BLECommissioningServer::rotateNonce() {
+  uint32_t next = esp_random();
+  uint8_t manufacturer[6] = {PROXIMITY_COMPANY_ID & 0xFF, PROXIMITY_COMPANY_ID >> 8};
+  memcpy(manufacturer + 2, &next, sizeof(next));
+
+  BLEAdvertisementData advertisement;
+  advertisement.setFlags(ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  advertisement.setCompleteServices(BLEUUID(PROXIMITY_SERVICE_UUID));
+  advertisement.setManufacturerData(std::string((const char *)manufacturer, sizeof(manufacturer)));
+
+  nonce = next;
+  nonceAt = millis();
+  pServer->getAdvertising()->setAdvertisementData(advertisement);
+}
+
+void BLECommissioningServer::poll() {
+  if (!proximity) return;
+  if (deviceConnected) {
+    // An idle connection keeps the lock off the air and its nonce from rotating
+    if (millis() - connectedAt > PROXIMITY_CONNECT_TIMEOUT_MS) {
+      idleDrops++;
+      connectedAt = millis();  // Asked again after another timeout if the link lingers
+      pServer->disconnect(pServer->getConnId());
+      Serial.println("[BLE] Dropped a central that didn't unlock in time");
+    }
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (millis() - nonceAt >= PROXIMITY_NONCE_ROTATE_MS) rotateNonce();
+  xSemaphoreGive(lock);
+}
+
+bool BLECommissioningServer::verifyUnlock(const uint8_t *data, size_t length) {
+  uint8_t slot = length ? data[0] : PROXIMITY_PHONES;
+  if (length != 1 + PROXIMITY_MAC_LEN || slot >= PROXIMITY_PHONES || !(enrolledMask & (1 << slot))) return false;
+
+  uint8_t message[5];
+  uint32_t challenge = nonce;
+  memcpy(message, &challenge, sizeof(challenge));
+  message[4] = slot;
+  uint8_t mac[32];
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), keys[slot], PROXIMITY_KEY_LEN, message,
+                  sizeof(message), mac);
+
+  uint8_t diff = 0;
+  for (size_t i = 0; i < PROXIMITY_MAC_LEN; i++) diff |= mac[i] ^ data[1 + i];
+  return diff == 0;
+}
+
+bool BLECommissioningServer::takeUnlock() {
+  if (!unlockPending) return false;
+  unlockPending = false;
+  return true;
+}
+
+void BLECommissioningServer::solenoidFired() {
+  if (!verifiedUs) return;  // Unlock came from somewhere else
+  int64_t now = esp_timer_get_time();
+  recordLatency(verifyToSolenoid, now - verifiedUs);
+  recordLatency(connectToSolenoid, now - connectUs);
+  verifiedUs = 0;
+}
+
+String BLECommissioningServer::proximityStatsJson() {
+  int64_t now = esp_timer_get_time();
+  int64_t total = proximity ? now - proximitySinceUs : 0;
+  int64_t advertising = advertisingUs + (proximity && !deviceConnected ? now - advertisingSinceUs : 0);
+  float advertisingShare = total > 0 ? (float)advertising / total : 0;
+  // Radio on-time per advertising event is estimated from the PDU airtime, the stack doesn't report it
+  float dutyPct = advertisingShare * 100.0f * PROXIMITY_ADV_EVENT_US / (PROXIMITY_ADV_INTERVAL_MS * 1000.0f + 5000.0f);
+
+  return "{\"active\":" + String(proximity ? "true" : "false") +
+         ",\"enrolled\":" + String(__builtin_popcount(enrolledMask)) + ",\"unlocks\":" + String(unlocks) +
+         ",\"rejected\":" + String(rejected) + ",\"idle_drops\":" + String(idleDrops) +
+         ",\"adv_interval_ms\":" + String(PROXIMITY_ADV_INTERVAL_MS) +
+         ",\"advertising_pct\":" + String(advertisingShare * 100.0f, 1) +
+         ",\"adv_duty_pct_est\":" + String(dutyPct, 3) +
+         ",\"latency\":{\"connect_to_verify\":" + latencyJson(connectToVerify) +
+         ",\"verify_to_solenoid\":" + latencyJson(verifyToSolenoid) +
+         ",\"connect_to_solenoid\":" + latencyJson(connectToSolenoid) + "}}";
+}
+
+// ==================== UnlockCharacteristicCallbacks ====================
+void UnlockCharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic) {
+  HEAP_SCOPE(BLE);
+  xSemaphoreTake(bleServer->lock, portMAX_DELAY);
+  if (bleServer->verifyUnlock(pCharacteristic->getData(), pCharacteristic->getLength())) {
+    bleServer->verifiedUs = esp_timer_get_time();
+    recordLatency(bleServer->connectToVerify, bleServer->verifiedUs - bleServer->connectUs);
+    bleServer->unlocks++;
+    bleServer->unlockPending = true;
+    powerManager.signal(WakeSource::BLE, false);  // Solenoid is driven from loop()
+  } else {
+    bleServer->rejected++;
+    Serial.println("[BLE] Proximity unlock rejected");
+  }
+
+  // One attempt per challenge, then free the radio straight away
+  bleServer->rotateNonce();
+  xSemaphoreGive(bleServer->lock);
+  bleServer->pServer->disconnect(bleServer->pServer->getConnId());
+}
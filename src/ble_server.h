@@ -6,12 +6,34 @@
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
+#include <freertos/semphr.h>
+
+#include "wire.h"
 
 // UUIDs for BLE Service and Characteristics
 #define SERVICE_UUID "12345678-1234-5678-1234-56789abcdef0"
 #define RX_CHAR_UUID "87654321-4321-8765-4321-0fedcba98765"  // Receive commissioning payload
 #define TX_CHAR_UUID "abcdef12-5678-90ab-cdef-1234567890ab"  // Send lock info response
 
+// Post-commissioning proximity unlock
+#define PROXIMITY_SERVICE_UUID "12345678-1234-5678-1234-56789abcdef1"
+#define UNLOCK_CHAR_UUID "87654321-4321-8765-4321-0fedcba98766"  // Phone writes [slot][truncated HMAC]
+#define PROXIMITY_NAMESPACE "ble_prox"
+#define PROXIMITY_PHONES 4                 // Enrolled phone slots
+#define PROXIMITY_KEY_LEN 32
+#define PROXIMITY_MAC_LEN 16               // HMAC-SHA256(key, nonce || slot), truncated
+#define PROXIMITY_ADV_INTERVAL_MS 1000     // Long interval, the phone is the one scanning
+#define PROXIMITY_NONCE_ROTATE_MS 60000UL  // Advertised challenge also changes after every attempt
+#define PROXIMITY_CONNECT_TIMEOUT_MS 3000  // A central that hasn't written a valid unlock by then is dropped
+#define PROXIMITY_COMPANY_ID 0xFFFF        // Manufacturer data ID, 0xFFFF is reserved for testing
+#define PROXIMITY_ADV_EVENT_US 1920        // 3 channels x (360 us ADV_IND airtime + ramp and receive window)
+
+struct ProximityLatency {
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
 class BLECommissioningServer {
 public:
   BLECommissioningServer();
@@ -24,16 +46,54 @@ public:
   bool hasReceivedIPAck();
   void end();
 
+  // Lean mode after commissioning: one write-only characteristic and a challenge nonce in the
+  // advertising data, so an enrolled phone unlocks with a single write after connecting
+  bool beginProximity(const char *deviceName);
+  bool proximityActive() const { return proximity; }
+  bool proximityEnrolled();
+  int enrollPhone(uint8_t *key);  // Fills a fresh PROXIMITY_KEY_LEN key, returns the slot or -1
+  bool removePhone(uint8_t slot);
+  void poll();        // Rotates the advertised nonce and drops idle centrals
+  bool takeUnlock();  // True once per verified unlock request
+  void solenoidFired();
+  String proximityStatsJson();
+
 private:
+  void loadKeys();
+  void rotateNonce();  // Callers hold lock
+  bool verifyUnlock(const uint8_t *data, size_t length);
+
   BLEServer *pServer;
   BLECharacteristic *pRxCharacteristic;
   BLECharacteristic *pTxCharacteristic;
   bool deviceConnected;
   bool payloadReceived;
   bool ipReceivedAck;
+  WireFormat wire;  // Encoding of the app's last write, responses follow it
+
+  bool proximity;
+  uint8_t keys[PROXIMITY_PHONES][PROXIMITY_KEY_LEN];
+  uint8_t enrolledMask;
+  SemaphoreHandle_t lock;  // Keys, nonce rotation and checks, from the BLE callback task and loop()
+  uint32_t nonce;
+  unsigned long nonceAt;
+  volatile bool unlockPending;
+  uint32_t unlocks;
+  uint32_t rejected;
+  uint32_t idleDrops;                  // Centrals disconnected for not writing in time
+  volatile unsigned long connectedAt;  // millis() of the current connection, read by poll()
+  int64_t connectUs;   // Phone connected
+  int64_t verifiedUs;  // Unlock write verified, cleared once the solenoid fires
+  int64_t advertisingSinceUs;
+  int64_t advertisingUs;  // Time spent advertising, excluding the current stretch
+  int64_t proximitySinceUs;
+  ProximityLatency connectToVerify;
+  ProximityLatency verifyToSolenoid;
+  ProximityLatency connectToSolenoid;
 
   friend class ServerCallbacks;
   friend class RxCharacteristicCallbacks;
+  friend class UnlockCharacteristicCallbacks;
 };
 
 // Callback class for BLE Server events
@@ -59,4 +119,15 @@ private:
   BLECommissioningServer *bleServer;
 };
 
+// Callback class for the proximity unlock characteristic
+class UnlockCharacteristicCallbacks : public BLECharacteristicCallbacks {
+public:
+  UnlockCharacteristicCallbacks(BLECommissioningServer *server) : bleServer(server) {}
+
+  void onWrite(BLECharacteristic *pCharacteristic);
+
+private:
+  BLECommissioningServer *bleServer;
+};
+
 #endif  // BLE_SERVER_H
@@ -0,0 +1,98 @@
+#include "commands.h"
+#include <esp_timer.h>
+
+static const char *COMMAND_NAMES[] = {"unlock", "start_call", "end_call", "get_stalls", "ota"};
+static const char *PATH_NAMES[] = {"local", "cloud"};
+
+const char *commandName(CommandType type) { return COMMAND_NAMES[(size_t)type]; }
+
+const char *commandCapabilities() { return "unlock,start_call,end_call,get_stalls,ota"; }
+
+bool parseCommand(JsonVariantConst doc, Command &command) {
+  const char *cmd = doc["cmd"] | "";
+  size_t type = 0;
+  while (type < (size_t)CommandType::Count && strcmp(cmd, COMMAND_NAMES[type]) != 0) type++;
+  if (type == (size_t)CommandType::Count) return false;
+
+  const char *id = doc["id"] | "";
+  if (strlen(id) > COMMAND_ID_LEN) return false;
+
+  command.type = (CommandType)type;
+  strcpy(command.id, id);
+  command.name = doc["name"];
+  command.roomId = doc["room_id"] | "";
+  command.url = doc["url"] | "";
+  command.sha256 = doc["sha256"] | "";
+  command.signature = doc["signature"] | "";
+  command.version = doc["version"] | "";
+  command.size = doc["size"] | 0;
+  return true;
+}
+
+static void recordLatency(CommandLatency &latency, uint32_t us) {
+  latency.count++;
+  latency.totalUs += us;
+  if (us > latency.maxUs) latency.maxUs = us;
+}
+
+static String latencyJson(const CommandLatency &latency) {
+  return "{\"count\":" + String(latency.count) +
+         ",\"avg_us\":" + String(latency.count ? (uint32_t)(latency.totalUs / latency.count) : 0) +
+         ",\"max_us\":" + String(latency.maxUs) + "}";
+}
+
+CommandLog::CommandLog() : entries(), head(0), served(), duplicates(), latency(), raceMargin() {}
+
+// The id comes from the client, so it goes through the serializer to be escaped
+String CommandLog::ack(const Entry &entry, bool isDuplicate) {
+  JsonDocument doc;
+  doc["id"] = (const char *)entry.id;
+  doc["cmd"] = commandName(entry.type);
+  doc["status"] = entry.ok ? "ok" : "error";
+  doc["path"] = PATH_NAMES[(size_t)entry.path];
+  doc["duplicate"] = isDuplicate;
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+bool CommandLog::duplicate(const Command &command, CommandPath path, int64_t receivedUs, String &reply) {
+  if (!command.id[0]) return false;
+  for (const Entry &entry : entries) {
+    if (strcmp(entry.id, command.id) != 0) continue;
+    duplicates[(size_t)path]++;
+    if (entry.path != path) recordLatency(raceMargin, receivedUs - entry.receivedUs);
+    reply = ack(entry, true);
+    return true;
+  }
+  return false;
+}
+
+String CommandLog::record(const Command &command, CommandPath path, bool ok, int64_t receivedUs) {
+  served[(size_t)path]++;
+  recordLatency(latency[(size_t)path], esp_timer_get_time() - receivedUs);
+
+  Entry entry = {};
+  strcpy(entry.id, command.id);
+  entry.type = command.type;
+  entry.path = path;
+  entry.ok = ok;
+  entry.receivedUs = receivedUs;
+  if (command.id[0]) {
+    entries[head] = entry;
+    head = (head + 1) % COMMAND_DEDUP_SIZE;
+  }
+  return ack(entry, false);
+}
+
+String CommandLog::statsJson() const {
+  uint32_t total = served[(size_t)CommandPath::Local] + served[(size_t)CommandPath::Cloud];
+  String json = "{\"served\":" + String(total) + ",\"local_pct\":" +
+                String(total ? served[(size_t)CommandPath::Local] * 100 / total : 0);
+  for (size_t p = 0; p < (size_t)CommandPath::Count; p++) {
+    json += ",\"" + String(PATH_NAMES[p]) + "\":{\"served\":" + String(served[p]) +
+            ",\"duplicates\":" + String(duplicates[p]) + ",\"latency\":" + latencyJson(latency[p]) + "}";
+  }
+  json += ",\"race_margin\":" + latencyJson(raceMargin) + "}";
+  return json;
+}
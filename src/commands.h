@@ -0,0 +1,66 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define COMMAND_ID_LEN 32      // App-generated command ID, longer IDs are rejected
+#define COMMAND_DEDUP_SIZE 16  // Recent command IDs remembered for de-duplication
+
+// Typed command set accepted over both POST /command and MQTT
+enum class CommandType : uint8_t { Unlock, StartCall, EndCall, GetStalls, Ota, Count };
+enum class CommandPath : uint8_t { Local, Cloud, Count };
+
+struct Command {
+  CommandType type;
+  char id[COMMAND_ID_LEN + 1];  // Empty for legacy messages without an ID, which are never de-duplicated
+  const char *name;             // Fields below point into the parsed document
+  const char *roomId;
+  const char *url;
+  const char *sha256;
+  const char *signature;
+  const char *version;
+  uint32_t size;
+};
+
+struct CommandLatency {
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+const char *commandName(CommandType type);
+const char *commandCapabilities();  // Comma separated command names, advertised over mDNS
+bool parseCommand(JsonVariantConst doc, Command &command);
+
+// Remembers recent command IDs and their outcome, so the app can race the same command
+// over the LAN and the cloud and act on whichever ack arrives first.
+class CommandLog {
+public:
+  CommandLog();
+
+  // Both take the time the command was received. duplicate() fills the original ack if the ID was seen
+  bool duplicate(const Command &command, CommandPath path, int64_t receivedUs, String &ack);
+  String record(const Command &command, CommandPath path, bool ok, int64_t receivedUs);  // Returns the ack
+  String statsJson() const;
+
+private:
+  struct Entry {
+    char id[COMMAND_ID_LEN + 1];
+    CommandType type;
+    CommandPath path;  // Path that served it first
+    bool ok;
+    int64_t receivedUs;  // When the first copy arrived
+  };
+
+  static String ack(const Entry &entry, bool isDuplicate);
+
+  Entry entries[COMMAND_DEDUP_SIZE];
+  size_t head;
+  uint32_t served[(size_t)CommandPath::Count];
+  uint32_t duplicates[(size_t)CommandPath::Count];  // Late copies that arrived on this path
+  CommandLatency latency[(size_t)CommandPath::Count];  // Receive to ack
+  CommandLatency raceMargin;  // Receive time of the losing path's copy minus the winner's
+};
+
+#endif  // COMMANDS_H
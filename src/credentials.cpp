@@ -0,0 +1,194 @@
+#include "credentials.h"
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+
+#define SESSION_PAYLOAD_LEN 12  // expiry, client, nonce
+#define SESSION_MAC_LEN 16      // Truncated HMAC-SHA256
+#define SESSION_TOKEN_LEN ((SESSION_PAYLOAD_LEN + SESSION_MAC_LEN) * 2)
+
+static bool constantTimeEquals(const uint8_t *a, const uint8_t *b, size_t length) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < length; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+static void recordTiming(AuthTiming &timing, int64_t startUs) {
+  uint32_t elapsed = esp_timer_get_time() - startUs;
+  timing.count++;
+  timing.totalUs += elapsed;
+  if (elapsed > timing.maxUs) timing.maxUs = elapsed;
+}
+
+Credentials credentials;
+
+Credentials::Credentials() : pinSet(false), salt(), verifier(), sessionKey(), clients(), pinTiming(), sessionTiming() {}
+
+// ==================== PIN verifier ====================
+void Credentials::begin() {
+  esp_fill_random(sessionKey, sizeof(sessionKey));
+
+  Preferences prefs;
+  prefs.begin(CRED_NAMESPACE, false);
+  if (prefs.isKey("pin")) {
+    // Legacy plaintext PIN from older firmware or commissioning: hash it and drop the original
+    String legacy = prefs.getString("pin");
+    prefs.end();
+    if (!legacy.isEmpty()) setPin(legacy.c_str());
+    prefs.begin(CRED_NAMESPACE, false);
+    prefs.remove("pin");
+  }
+  pinSet = prefs.getBytes("pin_salt", salt, sizeof(salt)) == sizeof(salt) &&
+           prefs.getBytes("pin_hash", verifier, sizeof(verifier)) == sizeof(verifier);
+  prefs.end();
+}
+
+void Credentials::derive(const char *pin, const uint8_t *pinSalt, uint8_t *out) const {
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  mbedtls_pkcs5_pbkdf2_hmac(&ctx, (const unsigned char *)pin, strlen(pin), pinSalt, CRED_SALT_LEN,
+                            CRED_PBKDF2_ITERATIONS, CRED_HASH_LEN, out);
+  mbedtls_md_free(&ctx);
+}
+
+bool Credentials::setPin(const char *pin) {
+  if (!pin || !*pin) return false;
+
+  uint8_t newSalt[CRED_SALT_LEN];
+  uint8_t newVerifier[CRED_HASH_LEN];
+  esp_fill_random(newSalt, sizeof(newSalt));
+  derive(pin, newSalt, newVerifier);
+
+  Preferences prefs;
+  prefs.begin(CRED_NAMESPACE, false);
+  bool stored = prefs.putBytes("pin_salt", newSalt, sizeof(newSalt)) == sizeof(newSalt) &&
+                prefs.putBytes("pin_hash", newVerifier, sizeof(newVerifier)) == sizeof(newVerifier);
+  prefs.end();
+  if (!stored) return false;
+
+  memcpy(salt, newSalt, sizeof(salt));
+  memcpy(verifier, newVerifier, sizeof(verifier));
+  pinSet = true;
+  return true;
+}
+
+bool Credentials::verifyPin(const char *pin) {
+  if (!pinSet) {
+    Serial.println("No pin code is set");
+    return true;
+  }
+  if (!pin) return false;
+
+  int64_t start = esp_timer_get_time();
+  uint8_t candidate[CRED_HASH_LEN];
+  derive(pin, salt, candidate);
+  bool ok = constantTimeEquals(candidate, verifier, sizeof(verifier));
+  recordTiming(pinTiming, start);
+  return ok;
+}
+
+// ==================== Session tokens ====================
+static void toHex(const uint8_t *data, size_t length, char *out) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < length; i++) {
+    out[i * 2] = digits[data[i] >> 4];
+    out[i * 2 + 1] = digits[data[i] & 0x0F];
+  }
+  out[length * 2] = '\0';
+}
+
+static bool fromHex(const char *hex, uint8_t *out, size_t length) {
+  for (size_t i = 0; i < length * 2; i++) {
+    char c = hex[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') nibble = c - '0';
+    else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+    else return false;
+    out[i / 2] = (i % 2) ? (out[i / 2] | nibble) : (nibble << 4);
+  }
+  return true;
+}
+
+String Credentials::mintSession(uint32_t client) {
+  uint8_t token[SESSION_PAYLOAD_LEN + 32];
+  uint32_t expiry = esp_timer_get_time() / 1000000 + CRED_SESSION_TTL;
+  uint32_t nonce = esp_random();
+  memcpy(token, &expiry, 4);
+  memcpy(token + 4, &client, 4);
+  memcpy(token + 8, &nonce, 4);
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sessionKey, sizeof(sessionKey), token,
+                  SESSION_PAYLOAD_LEN, token + SESSION_PAYLOAD_LEN);
+
+  char hex[SESSION_TOKEN_LEN + 1];
+  toHex(token, SESSION_PAYLOAD_LEN + SESSION_MAC_LEN, hex);
+  return String(hex);
+}
+
+bool Credentials::verifySession(const String &tokenHex, uint32_t client) {
+  if (tokenHex.length() != SESSION_TOKEN_LEN) return false;
+
+  int64_t start = esp_timer_get_time();
+  uint8_t token[SESSION_PAYLOAD_LEN + SESSION_MAC_LEN];
+  uint8_t mac[32];
+  bool ok = fromHex(tokenHex.c_str(), token, sizeof(token));
+  if (ok) {
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sessionKey, sizeof(sessionKey), token,
+                    SESSION_PAYLOAD_LEN, mac);
+    uint32_t expiry, boundClient;
+    memcpy(&expiry, token, 4);
+    memcpy(&boundClient, token + 4, 4);
+    ok = constantTimeEquals(mac, token + SESSION_PAYLOAD_LEN, SESSION_MAC_LEN) && boundClient == client &&
+         expiry > esp_timer_get_time() / 1000000;
+  }
+  recordTiming(sessionTiming, start);
+  return ok;
+}
+
+// ==================== Per-client lockout ====================
+Credentials::ClientState *Credentials::findClient(uint32_t client, bool create) {
+  ClientState *oldest = &clients[0];
+  for (size_t i = 0; i < CRED_CLIENT_SLOTS; i++) {
+    if (clients[i].lastSeen && clients[i].address == client) return &clients[i];
+    if (clients[i].lastSeen < oldest->lastSeen) oldest = &clients[i];
+  }
+  if (!create) return nullptr;
+  *oldest = ClientState{client, 0, 0, millis() | 1};  // lastSeen 0 marks a free slot
+  return oldest;
+}
+
+unsigned long Credentials::lockoutRemaining(uint32_t client) {
+  ClientState *state = findClient(client, false);
+  if (!state || state->fails < CRED_MAX_FAILS) return 0;
+
+  unsigned long elapsed = millis() - state->lockedAt;
+  if (elapsed >= CRED_LOCKOUT_MS) {
+    state->fails = 0;
+    return 0;
+  }
+  return CRED_LOCKOUT_MS - elapsed;
+}
+
+void Credentials::recordFailure(uint32_t client) {
+  ClientState *state = findClient(client, true);
+  state->lastSeen = millis() | 1;
+  if (++state->fails == CRED_MAX_FAILS) state->lockedAt = millis();
+}
+
+void Credentials::recordSuccess(uint32_t client) {
+  ClientState *state = findClient(client, false);
+  if (state) state->fails = 0;
+}
+
+String Credentials::timingJson() const {
+  String json = "{\"pin\":{\"count\":" + String(pinTiming.count) + ",\"avg_us\":" +
+                String(pinTiming.count ? (uint32_t)(pinTiming.totalUs / pinTiming.count) : 0) +
+                ",\"max_us\":" + String(pinTiming.maxUs) + "}";
+  json += ",\"session\":{\"count\":" + String(sessionTiming.count) + ",\"avg_us\":" +
+          String(sessionTiming.count ? (uint32_t)(sessionTiming.totalUs / sessionTiming.count) : 0) +
+          ",\"max_us\":" + String(sessionTiming.maxUs) + "}}";
+  return json;
+}
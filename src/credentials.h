@@ -0,0 +1,70 @@
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+#include <Arduino.h>
+
+#ifdef UNIT_TEST
+#define CRED_NAMESPACE "cred_test"  // Benchmarks set their own PIN without touching the lock's
+#else
+#define CRED_NAMESPACE "my_storage"
+#endif
+#define CRED_PBKDF2_ITERATIONS 10000  // PBKDF2-HMAC-SHA256 rounds per PIN check
+#define CRED_SALT_LEN 16
+#define CRED_HASH_LEN 32
+#define CRED_SESSION_TTL 600UL  // Session token lifetime in seconds
+#define CRED_MAX_FAILS 3        // Failed attempts before a client is locked out
+#define CRED_LOCKOUT_MS (30 * 60000UL)
+#define CRED_CLIENT_SLOTS 8     // Clients tracked for lockout, least recently seen is evicted
+#define CRED_KEYPAD_CLIENT 0    // Pseudo address for the touchscreen keypad
+
+struct AuthTiming {
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+// PIN kept as a salted PBKDF2 verifier. The verifier is cached in RAM, so a check
+// is one key derivation plus a constant-time compare with no NVS access. A good PIN
+// mints an HMAC session token that later requests verify with a single MAC.
+class Credentials {
+public:
+  Credentials();
+
+  void begin();  // Loads the verifier, migrating a legacy plaintext "pin" if present
+  bool hasPin() const { return pinSet; }
+  bool setPin(const char *pin);
+  bool verifyPin(const char *pin);
+
+  String mintSession(uint32_t client);
+  bool verifySession(const String &token, uint32_t client);
+
+  // Per-client lockout, client is the IPv4 address or CRED_KEYPAD_CLIENT
+  unsigned long lockoutRemaining(uint32_t client);
+  void recordFailure(uint32_t client);
+  void recordSuccess(uint32_t client);
+
+  String timingJson() const;
+
+private:
+  struct ClientState {
+    uint32_t address;
+    uint8_t fails;
+    unsigned long lockedAt;
+    unsigned long lastSeen;
+  };
+
+  void derive(const char *pin, const uint8_t *salt, uint8_t *out) const;
+  ClientState *findClient(uint32_t client, bool create);
+
+  bool pinSet;
+  uint8_t salt[CRED_SALT_LEN];
+  uint8_t verifier[CRED_HASH_LEN];
+  uint8_t sessionKey[32];  // Random per boot, so tokens die with a reset
+  ClientState clients[CRED_CLIENT_SLOTS];
+  AuthTiming pinTiming;
+  AuthTiming sessionTiming;
+};
+
+extern Credentials credentials;
+
+#endif  // CREDENTIALS_H
@@ -0,0 +1,224 @@
+#include "energy.h"
+#include "battery.h"
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#define ENERGY_RECORD_VERSION 1
+#define UA_US_PER_UAH 3600000000ULL
+#define TREND_CLOSED 0xFF
+
+static const char *CONSUMER_NAMES[] = {"cpu", "wifi", "k230d", "solenoid", "ble", "display"};
+static const char *STATE_NAMES[] = {"off", "sleep", "idle", "active"};
+
+static const uint32_t CURRENT_UA[(size_t)EnergyConsumer::Count][(size_t)EnergyState::Count] = {
+    {0, ENERGY_UA_CPU_SLEEP, ENERGY_UA_CPU_IDLE, ENERGY_UA_CPU_ACTIVE},
+    {0, 0, ENERGY_UA_WIFI_IDLE, ENERGY_UA_WIFI_ACTIVE},
+    {0, 0, 0, ENERGY_UA_K230D},
+    {0, 0, 0, ENERGY_UA_SOLENOID},
+    {0, 0, ENERGY_UA_BLE_IDLE, ENERGY_UA_BLE_ACTIVE},
+    {0, 0, 0, ENERGY_UA_DISPLAY},
+};
+
+EnergyLedger energyLedger;
+
+EnergyLedger::EnergyLedger()
+    : lock(nullptr), record(), states(), sinceUs(), onUs(), chargeUaUs(), pendingUaUs(), transitions(), lastUpdateUs(0),
+      lastIdleUs(0), lastFlushUs(0), beganUs(0) {}
+
+void EnergyLedger::begin() {
+  lock = xSemaphoreCreateMutex();
+  Preferences prefs;
+  prefs.begin(ENERGY_NAMESPACE, true);
+  bool restored = prefs.getBytes("ledger", &record, sizeof(record)) == sizeof(record) &&
+                  record.version == ENERGY_RECORD_VERSION;
+  prefs.end();
+  if (!restored) {
+    memset(&record, 0, sizeof(record));
+    record.version = ENERGY_RECORD_VERSION;
+    record.trendLevel = TREND_CLOSED;
+  }
+
+  int64_t now = esp_timer_get_time();
+  for (int64_t &since : sinceUs) since = now;
+  beganUs = lastUpdateUs = lastFlushUs = now;
+
+  // OTA reboots and rollbacks restart from deep inside their own code, this catches all of them
+  esp_register_shutdown_handler([]() { energyLedger.flush(); });
+}
+
+void EnergyLedger::accrue(EnergyConsumer consumer, EnergyState state, int64_t us) {
+  if (us <= 0) return;
+  size_t c = (size_t)consumer;
+  uint64_t charge = (uint64_t)us * CURRENT_UA[c][(size_t)state];
+  onUs[c][(size_t)state] += us;
+  chargeUaUs[c][(size_t)state] += charge;
+  pendingUaUs[c] += charge;
+}
+
+void EnergyLedger::set(EnergyConsumer consumer, EnergyState state) {
+  size_t c = (size_t)consumer;
+  if (consumer == EnergyConsumer::Cpu || !lock) return;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (states[c] != state) {
+    int64_t now = esp_timer_get_time();
+    accrue(consumer, states[c], now - sinceUs[c]);
+    sinceUs[c] = now;
+    states[c] = state;
+    transitions[c]++;
+  }
+  xSemaphoreGive(lock);
+}
+
+// Brings every switched consumer up to now and moves whole microamp-hours into the record
+void EnergyLedger::settle(int64_t now) {
+  for (size_t c = 0; c < (size_t)EnergyConsumer::Count; c++) {
+    if (c != (size_t)EnergyConsumer::Cpu) {
+      accrue((EnergyConsumer)c, states[c], now - sinceUs[c]);
+      sinceUs[c] = now;
+    }
+    uint32_t uah = pendingUaUs[c] / UA_US_PER_UAH;
+    pendingUaUs[c] -= (uint64_t)uah * UA_US_PER_UAH;
+    record.dayUah[record.head][c] += uah;
+    if (record.trendLevel != TREND_CLOSED) record.trendUah += uah;
+  }
+}
+
+void EnergyLedger::update(int64_t idleUs, bool lightSleep, uint8_t batteryLevel) {
+  if (!lock) return;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  int64_t elapsed = now - lastUpdateUs;
+  if (elapsed < (int64_t)ENERGY_UPDATE_MS * 1000) {
+    xSemaphoreGive(lock);
+    return;
+  }
+
+  // Time loop() spent blocked is idle, light sleep when the power manager could enable it
+  int64_t idle = constrain(idleUs - lastIdleUs, (int64_t)0, elapsed);
+  accrue(EnergyConsumer::Cpu, lightSleep ? EnergyState::Sleep : EnergyState::Idle, idle);
+  accrue(EnergyConsumer::Cpu, EnergyState::Active, elapsed - idle);
+  lastIdleUs = idleUs;
+  lastUpdateUs = now;
+
+  // A level well above the window's start means the pack was charged or swapped
+  if (record.trendLevel == TREND_CLOSED || batteryLevel > record.trendLevel + BATTERY_HYSTERESIS) {
+    record.trendLevel = batteryLevel;
+    record.trendMs = 0;
+    record.trendUah = 0;
+  }
+  settle(now);
+
+  uint32_t elapsedMs = elapsed / 1000;
+  record.dayMs += elapsedMs;
+  record.trendMs += elapsedMs;
+  if (record.dayMs >= ENERGY_DAY_MS) {
+    rollDay();
+    write();
+  } else if (now - lastFlushUs >= (int64_t)ENERGY_FLUSH_MS * 1000) {
+    write();
+  }
+  xSemaphoreGive(lock);
+}
+
+void EnergyLedger::rollDay() {
+  record.dayMs -= ENERGY_DAY_MS;
+  record.head = (record.head + 1) % ENERGY_DAYS;
+  if (record.completed < ENERGY_DAYS - 1) record.completed++;
+  memset(record.dayUah[record.head], 0, sizeof(record.dayUah[record.head]));
+}
+
+// The reset hook runs while loop() may be stuck inside update(), a torn record must never reach flash
+void EnergyLedger::flush() {
+  if (!lock || xSemaphoreTake(lock, pdMS_TO_TICKS(ENERGY_LOCK_WAIT_MS)) != pdTRUE) return;
+  settle(esp_timer_get_time());
+  write();
+  xSemaphoreGive(lock);
+}
+
+void EnergyLedger::write() {
+  Preferences prefs;
+  prefs.begin(ENERGY_NAMESPACE, false);
+  prefs.putBytes("ledger", &record, sizeof(record));
+  prefs.end();
+  lastFlushUs = esp_timer_get_time();
+}
+
+uint32_t EnergyLedger::todayUah() const {
+  uint32_t total = 0;
+  for (uint32_t uah : record.dayUah[record.head]) total += uah;
+  return total;
+}
+
+EnergyProjection EnergyLedger::projection(uint8_t batteryLevel) const {
+  if (!lock) return project(batteryLevel);
+  xSemaphoreTake(lock, portMAX_DELAY);
+  EnergyProjection p = project(batteryLevel);
+  xSemaphoreGive(lock);
+  return p;
+}
+
+EnergyProjection EnergyLedger::project(uint8_t batteryLevel) const {
+  EnergyProjection p = {0, -1, -1, 0, 0};
+
+  // Average of the completed days, or today's rate scaled to a day until one completes
+  if (record.completed) {
+    uint64_t total = 0;
+    for (uint8_t d = 1; d <= record.completed; d++) {
+      for (uint32_t uah : record.dayUah[(record.head + ENERGY_DAYS - d) % ENERGY_DAYS]) total += uah;
+    }
+    p.dailyMah = total / 1000.0f / record.completed;
+  } else if (record.dayMs >= ENERGY_MIN_PROJECTION_MS) {
+    p.dailyMah = todayUah() / 1000.0f * ENERGY_DAY_MS / record.dayMs;
+  }
+  if (p.dailyMah > 0) p.daysToEmpty = batteryLevel / 100.0f * ENERGY_BATTERY_MAH / p.dailyMah;
+
+  if (record.trendLevel != TREND_CLOSED) {
+    p.modelDropPct = record.trendUah / 10.0f / ENERGY_BATTERY_MAH;
+    p.measuredDropPct = record.trendLevel > batteryLevel ? record.trendLevel - batteryLevel : 0;
+    if (p.measuredDropPct >= ENERGY_TREND_MIN_DROP && record.trendMs) {
+      float dropPerDay = (float)p.measuredDropPct * ENERGY_DAY_MS / record.trendMs;
+      p.trendDaysToEmpty = batteryLevel / dropPerDay;
+    }
+  }
+  return p;
+}
+
+static String formatProjection(const EnergyProjection &p) {
+  return "{\"daily_mah\":" + String(p.dailyMah, 1) + ",\"days_to_empty\":" + String(p.daysToEmpty, 1) +
+         ",\"trend_days_to_empty\":" + String(p.trendDaysToEmpty, 1) + ",\"model_drop_pct\":" +
+         String(p.modelDropPct, 1) + ",\"measured_drop_pct\":" + String(p.measuredDropPct) + "}";
+}
+
+String EnergyLedger::projectionJson(uint8_t batteryLevel) const { return formatProjection(projection(batteryLevel)); }
+
+String EnergyLedger::statsJson(uint8_t batteryLevel) const {
+  if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+  String json = "{\"uptime_s\":" + String((uint32_t)((esp_timer_get_time() - beganUs) / 1000000)) +
+                ",\"day_s\":" + String(record.dayMs / 1000) + ",\"days_mah\":[";
+  for (uint8_t d = 0; d <= record.completed; d++) {
+    uint32_t total = 0;
+    for (uint32_t uah : record.dayUah[(record.head + ENERGY_DAYS - d) % ENERGY_DAYS]) total += uah;
+    if (d) json += ",";
+    json += String(total / 1000.0f, 1);  // Today first
+  }
+  json += "],\"consumers\":{";
+  for (size_t c = 0; c < (size_t)EnergyConsumer::Count; c++) {
+    uint64_t charge = 0;
+    if (c) json += ",";
+    json += "\"" + String(CONSUMER_NAMES[c]) + "\":{\"on_s\":{";
+    bool first = true;
+    for (size_t s = 0; s < (size_t)EnergyState::Count; s++) {
+      charge += chargeUaUs[c][s];
+      if (!CURRENT_UA[c][s]) continue;  // Only states that draw current
+      if (!first) json += ",";
+      first = false;
+      json += "\"" + String(STATE_NAMES[s]) + "\":" + String((uint32_t)(onUs[c][s] / 1000000));
+    }
+    json += "},\"mah\":" + String(charge / (float)UA_US_PER_UAH / 1000.0f, 2) +
+            ",\"transitions\":" + String(transitions[c]) + "}";
+  }
+  json += "},\"projection\":" + formatProjection(project(batteryLevel)) + "}";
+  if (lock) xSemaphoreGive(lock);
+  return json;
+}
@@ -0,0 +1,116 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <Arduino.h>
+#include <freertos/semphr.h>
+
+#define ENERGY_NAMESPACE "energy"
+#define ENERGY_DAYS 7                              // Daily totals kept in flash, including today
+#define ENERGY_DAY_MS 86400000UL                   // Ledger days count accounted uptime, there is no wall clock
+#define ENERGY_UPDATE_MS 1000UL                    // Charge is folded into the totals this often
+#define ENERGY_FLUSH_MS (15 * 60000UL)             // Today's running total is written to flash this often
+#define ENERGY_MIN_PROJECTION_MS (60 * 60000UL)    // Today's rate is only extrapolated after an hour of data
+#define ENERGY_TREND_MIN_DROP 3                    // % the battery must fall before its trend is trusted
+#define ENERGY_LOCK_WAIT_MS 100                    // flush() skips the write rather than wait longer for the ledger
+
+// Pack capacity and per-state currents drawn from the pack, in microamps. Defaults assume an
+// 85% efficient buck from the 3S pack; measure your own hardware and override from build_flags.
+#ifndef ENERGY_BATTERY_MAH
+#define ENERGY_BATTERY_MAH 3000
+#endif
+#ifndef ENERGY_UA_CPU_SLEEP
+#define ENERGY_UA_CPU_SLEEP 300  // Automatic light sleep
+#endif
+#ifndef ENERGY_UA_CPU_IDLE
+#define ENERGY_UA_CPU_IDLE 8000  // Blocked in waitForEvent() at the minimum clock
+#endif
+#ifndef ENERGY_UA_CPU_ACTIVE
+#define ENERGY_UA_CPU_ACTIVE 17000
+#endif
+#ifndef ENERGY_UA_WIFI_IDLE
+#define ENERGY_UA_WIFI_IDLE 6000  // Associated, WIFI_PS_MAX_MODEM with listen_interval 3
+#endif
+#ifndef ENERGY_UA_WIFI_ACTIVE
+#define ENERGY_UA_WIFI_ACTIVE 12000  // MQTT session open, keep-alives and command traffic
+#endif
+#ifndef ENERGY_UA_K230D
+#define ENERGY_UA_K230D 150000
+#endif
+#ifndef ENERGY_UA_SOLENOID
+#define ENERGY_UA_SOLENOID 1000000
+#endif
+#ifndef ENERGY_UA_BLE_IDLE
+#define ENERGY_UA_BLE_IDLE 150  // Proximity advertising at PROXIMITY_ADV_INTERVAL_MS
+#endif
+#ifndef ENERGY_UA_BLE_ACTIVE
+#define ENERGY_UA_BLE_ACTIVE 5000  // Commissioning server or a connected phone
+#endif
+#ifndef ENERGY_UA_DISPLAY
+#define ENERGY_UA_DISPLAY 28000  // Keypad panel with backlight
+#endif
+
+enum class EnergyConsumer : uint8_t { Cpu, WiFi, K230D, Solenoid, Ble, Display, Count };
+enum class EnergyState : uint8_t { Off, Sleep, Idle, Active, Count };
+
+// Battery-life projection from the ledger, cross-checked against the measured level
+struct EnergyProjection {
+  float dailyMah;          // 0 until there is a completed day or an hour of today
+  float daysToEmpty;       // -1 when unknown
+  float trendDaysToEmpty;  // From the battery level trend, -1 until it has fallen ENERGY_TREND_MIN_DROP
+  float modelDropPct;      // Charge the ledger says was used since the trend window opened
+  uint8_t measuredDropPct; // What the battery level says over the same window
+};
+
+// Timestamps state transitions of each power consumer and integrates them with the
+// configured currents. Daily totals survive resets in NVS; the CPU is split into active
+// and idle time from the power manager instead of being switched by transitions.
+class EnergyLedger {
+public:
+  EnergyLedger();
+
+  void begin();  // Also flushes on every esp_restart()
+  void set(EnergyConsumer consumer, EnergyState state);
+  void update(int64_t idleUs, bool lightSleep, uint8_t batteryLevel);  // From loop()
+  void flush();  // Settles switched consumers up to now, then writes the record. Safe from any task
+
+  EnergyProjection projection(uint8_t batteryLevel) const;
+  String projectionJson(uint8_t batteryLevel) const;
+  String statsJson(uint8_t batteryLevel) const;
+
+private:
+  struct Record {
+    uint32_t version;
+    uint32_t dayMs;      // Accounted time into the current ledger day
+    uint8_t head;        // Slot of the current day in dayUah
+    uint8_t completed;   // Completed days stored, at most ENERGY_DAYS - 1
+    uint8_t trendLevel;  // Battery level when the trend window opened, 0xFF if not open
+    uint32_t trendMs;
+    uint64_t trendUah;
+    uint32_t dayUah[ENERGY_DAYS][(size_t)EnergyConsumer::Count];
+  };
+
+  // Callers hold lock
+  void accrue(EnergyConsumer consumer, EnergyState state, int64_t us);
+  void settle(int64_t now);
+  void rollDay();
+  void write();
+  uint32_t todayUah() const;
+  EnergyProjection project(uint8_t batteryLevel) const;
+
+  SemaphoreHandle_t lock;  // The stall monitor's reset hook and the shutdown handler flush from other tasks
+  Record record;
+  EnergyState states[(size_t)EnergyConsumer::Count];
+  int64_t sinceUs[(size_t)EnergyConsumer::Count];  // When each consumer entered its current state
+  uint64_t onUs[(size_t)EnergyConsumer::Count][(size_t)EnergyState::Count];
+  uint64_t chargeUaUs[(size_t)EnergyConsumer::Count][(size_t)EnergyState::Count];  // Since boot
+  uint64_t pendingUaUs[(size_t)EnergyConsumer::Count];  // Not yet folded into whole microamp-hours
+  uint32_t transitions[(size_t)EnergyConsumer::Count];
+  int64_t lastUpdateUs;
+  int64_t lastIdleUs;
+  int64_t lastFlushUs;
+  int64_t beganUs;
+};
+
+extern EnergyLedger energyLedger;
+
+#endif  // ENERGY_H
@@ -0,0 +1,263 @@
+#include "face_gallery.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
+#endif
+
+#define GALLERY_MAGIC 0x4A464731UL  // "JFG1"
+
+struct GalleryHeader {
+  uint32_t magic;
+  uint16_t dim;
+  uint16_t count;
+};
+
+// ==================== Vector math ====================
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(FACE_GALLERY_SCALAR)
+int32_t dotProductS8(const int8_t *a, const int8_t *b, size_t n) {
+  // 16 int8 MACs per EE.VMULAS into the 40-bit ACCX; a 128-dim sum fits in the low 32 bits
+  int32_t result;
+  size_t blocks = n / 16;
+  asm volatile(
+      "ee.zero.accx\n"
+      "1:\n"
+      "ee.vld.128.ip q0, %[a], 16\n"
+      "ee.vld.128.ip q1, %[b], 16\n"
+      "addi %[blocks], %[blocks], -1\n"
+      "ee.vmulas.s8.accx q0, q1\n"
+      "bnez %[blocks], 1b\n"
+      "rur.accx_0 %[result]\n"
+      : [result] "=r"(result), [a] "+r"(a), [b] "+r"(b), [blocks] "+r"(blocks)
+      :
+      : "memory");
+  return result;
+}
+#else
+int32_t dotProductS8(const int8_t *a, const int8_t *b, size_t n) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < n; i++) sum += (int32_t)a[i] * b[i];
+  return sum;
+}
+#endif
+
+static float inverseNorm(const int8_t *embedding) {
+  int32_t squared = dotProductS8(embedding, embedding, FACE_EMBEDDING_DIM);
+  return squared > 0 ? 1.0f / sqrtf((float)squared) : 0.0f;
+}
+
+static int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+bool decodeEmbedding(const char *base64, int8_t *out) {
+  if (!base64) return false;
+  size_t written = 0;
+  uint32_t bits = 0;
+  int pending = 0;
+
+  for (const char *p = base64; *p && *p != '='; p++) {
+    int value = base64Value(*p);
+    if (value < 0) return false;
+    bits = (bits << 6) | value;
+    pending += 6;
+    if (pending >= 8) {
+      pending -= 8;
+      if (written == FACE_EMBEDDING_DIM) return false;  // Longer than expected
+      out[written++] = (int8_t)((bits >> pending) & 0xFF);
+    }
+  }
+  return written == FACE_EMBEDDING_DIM;
+}
+
+// ==================== FaceGallery ====================
+static void *allocAligned(size_t bytes) {
+#ifdef ARDUINO
+  void *ptr = heap_caps_aligned_alloc(16, bytes, MALLOC_CAP_SPIRAM);
+  if (!ptr) ptr = heap_caps_aligned_alloc(16, bytes, MALLOC_CAP_8BIT);
+  return ptr;
+#else
+  return aligned_alloc(16, (bytes + 15) & ~(size_t)15);
+#endif
+}
+
+static void freeAligned(void *ptr) {
+#ifdef ARDUINO
+  heap_caps_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+FaceGallery::FaceGallery()
+    : embeddings(nullptr), invNorms(nullptr), names(nullptr), count(0), slots(0), persistent(true) {}
+
+FaceGallery::~FaceGallery() {
+  freeAligned(embeddings);
+  freeAligned(invNorms);
+  freeAligned(names);
+}
+
+bool FaceGallery::begin(bool persist) {
+  if (slots) return true;
+  persistent = persist;
+  return persistent ? load() : true;
+}
+
+// Doubles from FACE_GALLERY_MIN_SLOTS, so a lock with a few faces holds a few KB instead of the full gallery
+bool FaceGallery::reserve(size_t needed) {
+  if (needed <= slots) return true;
+  if (needed > FACE_GALLERY_MAX) return false;
+  size_t grown = slots ? slots : FACE_GALLERY_MIN_SLOTS;
+  while (grown < needed) grown *= 2;
+  if (grown > FACE_GALLERY_MAX) grown = FACE_GALLERY_MAX;
+
+  int8_t *newEmbeddings = (int8_t *)allocAligned(grown * FACE_EMBEDDING_DIM);
+  float *newInvNorms = (float *)allocAligned(grown * sizeof(float));
+  char(*newNames)[FACE_NAME_LEN] = (char(*)[FACE_NAME_LEN])allocAligned(grown * FACE_NAME_LEN);
+  if (!newEmbeddings || !newInvNorms || !newNames) {
+    freeAligned(newEmbeddings);
+    freeAligned(newInvNorms);
+    freeAligned(newNames);
+    return false;
+  }
+
+  if (count) {
+    memcpy(newEmbeddings, embeddings, count * FACE_EMBEDDING_DIM);
+    memcpy(newInvNorms, invNorms, count * sizeof(float));
+    memcpy(newNames, names, count * FACE_NAME_LEN);
+  }
+  freeAligned(embeddings);
+  freeAligned(invNorms);
+  freeAligned(names);
+  embeddings = newEmbeddings;
+  invNorms = newInvNorms;
+  names = newNames;
+  slots = grown;
+  return true;
+}
+
+int FaceGallery::find(const char *name) const {
+  for (size_t i = 0; i < count; i++) {
+    if (strncmp(names[i], name, FACE_NAME_LEN) == 0) return i;
+  }
+  return -1;
+}
+
+bool FaceGallery::enroll(const char *name, const int8_t *embedding) {
+  if (!name || !*name) return false;
+
+  int index = find(name);  // Re-enrolling replaces the old embedding
+  if (index < 0) {
+    if (!reserve(count + 1)) return false;
+    index = count++;
+  }
+
+  int8_t *row = embeddings + (size_t)index * FACE_EMBEDDING_DIM;
+  memcpy(row, embedding, FACE_EMBEDDING_DIM);
+  invNorms[index] = inverseNorm(row);
+  strncpy(names[index], name, FACE_NAME_LEN - 1);
+  names[index][FACE_NAME_LEN - 1] = '\0';
+  if (persistent) save();
+  return true;
+}
+
+bool FaceGallery::remove(const char *name) {
+  int index = find(name);
+  if (index < 0) return false;
+
+  // Move the last row into the hole to keep the arrays dense
+  size_t last = --count;
+  if ((size_t)index != last) {
+    memcpy(embeddings + (size_t)index * FACE_EMBEDDING_DIM, embeddings + last * FACE_EMBEDDING_DIM,
+           FACE_EMBEDDING_DIM);
+    invNorms[index] = invNorms[last];
+    memcpy(names[index], names[last], FACE_NAME_LEN);
+  }
+  if (persistent) save();
+  return true;
+}
+
+int FaceGallery::match(const int8_t *embedding, float &score) const {
+  float queryInvNorm = inverseNorm(embedding);
+  int best = -1;
+  score = 0;
+
+  const int8_t *row = embeddings;
+  for (size_t i = 0; i < count; i++, row += FACE_EMBEDDING_DIM) {
+    float similarity = dotProductS8(embedding, row, FACE_EMBEDDING_DIM) * invNorms[i] * queryInvNorm;
+    if (similarity > score) {
+      score = similarity;
+      best = i;
+    }
+  }
+  return (score >= FACE_MATCH_THRESHOLD) ? best : -1;
+}
+
+#ifdef ARDUINO
+void FaceGallery::save() const {
+  File file = LittleFS.open(FACE_GALLERY_FILE, "w");
+  if (!file) {
+    Serial.println("[Gallery] Failed to open gallery file for writing");
+    return;
+  }
+  GalleryHeader header = {GALLERY_MAGIC, FACE_EMBEDDING_DIM, (uint16_t)count};
+  file.write((const uint8_t *)&header, sizeof(header));
+  file.write((const uint8_t *)names, count * FACE_NAME_LEN);
+  file.write((const uint8_t *)embeddings, count * FACE_EMBEDDING_DIM);
+  file.close();
+}
+
+bool FaceGallery::load() {
+  if (!LittleFS.begin(true)) {
+    Serial.println("[Gallery] LittleFS mount failed");
+    return true;
+  }
+  File file = LittleFS.open(FACE_GALLERY_FILE, "r");
+  if (!file) return true;
+
+  GalleryHeader header;
+  if (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.magic != GALLERY_MAGIC ||
+      header.dim != FACE_EMBEDDING_DIM || header.count > FACE_GALLERY_MAX) {
+    Serial.println("[Gallery] Ignoring incompatible gallery file");
+    file.close();
+    return true;
+  }
+  if (!reserve(header.count)) {
+    Serial.printf("[Gallery] No room for %u enrolled faces\n", (unsigned)header.count);
+    file.close();
+    return false;
+  }
+
+  size_t nameBytes = header.count * FACE_NAME_LEN;
+  size_t embeddingBytes = header.count * FACE_EMBEDDING_DIM;
+  bool complete = file.read((uint8_t *)names, nameBytes) == nameBytes &&
+                  file.read((uint8_t *)embeddings, embeddingBytes) == embeddingBytes;
+  file.close();
+  if (!complete) {
+    Serial.println("[Gallery] Ignoring truncated gallery file");
+    return true;
+  }
+
+  count = header.count;
+  for (size_t i = 0; i < count; i++) {
+    names[i][FACE_NAME_LEN - 1] = '\0';
+    invNorms[i] = inverseNorm(embeddings + i * FACE_EMBEDDING_DIM);
+  }
+  Serial.printf("[Gallery] Loaded %u enrolled faces\n", (unsigned)count);
+  return true;
+}
+#else
+// Host builds keep the gallery in memory only
+void FaceGallery::save() const {}
+bool FaceGallery::load() { return true; }
+#endif
@@ -0,0 +1,58 @@
+#ifndef FACE_GALLERY_H
+#define FACE_GALLERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef FACE_EMBEDDING_DIM
+#define FACE_EMBEDDING_DIM 128  // int8 embedding streamed by the K230D, multiple of 16
+#endif
+#ifndef FACE_GALLERY_MAX
+#define FACE_GALLERY_MAX 1000  // Enrolled identities, 128KB of embeddings at full size
+#endif
+#define FACE_GALLERY_MIN_SLOTS 16  // First allocation, doubled each time the gallery fills
+#define FACE_NAME_LEN 32
+#define FACE_MATCH_THRESHOLD 0.6f  // Minimum cosine similarity for a match
+#define FACE_GALLERY_FILE "/gallery.bin"
+
+static_assert(FACE_EMBEDDING_DIM % 16 == 0, "PIE loads 16 bytes at a time");
+
+// int8 dot product, vectorized with the S3 PIE extension when available.
+// Both pointers must be 16-byte aligned and n a multiple of 16.
+int32_t dotProductS8(const int8_t *a, const int8_t *b, size_t n);
+
+// Decodes a base64 embedding from the K230D into FACE_EMBEDDING_DIM bytes
+bool decodeEmbedding(const char *base64, int8_t *out);
+
+// Enrolled faces kept as parallel arrays (structure of arrays), so a match
+// scans one contiguous block of embeddings instead of striding over names.
+class FaceGallery {
+public:
+  FaceGallery();
+  ~FaceGallery();
+
+  bool begin(bool persistent = true);  // Loads the saved gallery, false if there was no room for it
+  bool enroll(const char *name, const int8_t *embedding);
+  bool remove(const char *name);
+  int match(const int8_t *embedding, float &score) const;  // Index of best match or -1
+
+  size_t size() const { return count; }
+  size_t capacity() const { return FACE_GALLERY_MAX; }
+  const char *name(size_t index) const { return names[index]; }
+  bool enabled() const { return count > 0; }  // Gallery mode is on once anyone is enrolled
+
+private:
+  int find(const char *name) const;
+  bool reserve(size_t needed);  // Grows storage (PSRAM when present), nothing is allocated until needed
+  void save() const;
+  bool load();
+
+  int8_t *embeddings;                // count x FACE_EMBEDDING_DIM, rows 16-byte aligned
+  float *invNorms;                   // 1 / |embedding| per row
+  char (*names)[FACE_NAME_LEN];
+  size_t count;
+  size_t slots;  // Rows allocated
+  bool persistent;  // Mirrored to LittleFS, off for scratch galleries such as benchmarks
+};
+
+#endif  // FACE_GALLERY_H
@@ -0,0 +1,189 @@
+#include "heap_accounting.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+#define STATS_LOCK() portENTER_CRITICAL(&statsMux)
+#define STATS_UNLOCK() portEXIT_CRITICAL(&statsMux)
+#define CURRENT_TASK() ((void *)xTaskGetCurrentTaskHandle())
+
+size_t HeapAccounting::freeBytes() { return heap_caps_get_free_size(MALLOC_CAP_8BIT); }
+size_t HeapAccounting::largestFreeBlock() { return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT); }
+#else
+// Host build: count C++ heap traffic so the same accounting runs in native tests. Only
+// operator new is hooked; plain malloc (ArduinoJson's allocator among others) is not counted.
+#include <cstddef>
+#include <new>
+#include <stdlib.h>
+
+#define HOST_HEAP_SIZE (320 * 1024)  // Roughly the S3's usable internal heap
+#define HOST_HEADER alignof(std::max_align_t)  // Size kept in front of each block, keeps the alignment
+static size_t hostInUse = 0;
+
+void *operator new(size_t size) {
+  char *block = (char *)malloc(HOST_HEADER + size);
+  if (!block) throw std::bad_alloc();
+  *(size_t *)block = size;
+  hostInUse += size;
+  return block + HOST_HEADER;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr) return;
+  char *block = (char *)ptr - HOST_HEADER;
+  hostInUse -= *(size_t *)block;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+#define STATS_LOCK()
+#define STATS_UNLOCK()
+#define CURRENT_TASK() ((void *)nullptr)
+
+size_t HeapAccounting::freeBytes() { return hostInUse < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - hostInUse : 0; }
+size_t HeapAccounting::largestFreeBlock() { return freeBytes(); }
+#endif
+
+static const char *SUBSYSTEM_NAMES[] = {"ble", "rest", "mqtt", "notify", "ui", "k230d"};
+static const char *CYCLE_NAMES[] = {"unlock"};
+
+HeapAccounting heapAccounting;
+
+HeapAccounting::HeapAccounting()
+    : stats(), history(), historyHead(0), historyCount(0), grownSinceSample(0), lastSampleMs(0), cycleFree(),
+      cycleLive(), cycleMarks(), current(nullptr), ownerTask(nullptr) {}
+
+void HeapAccounting::begin() { ownerTask = CURRENT_TASK(); }
+
+// ==================== Scopes ====================
+void HeapAccounting::enter(Subsystem subsystem, HeapScopeFrame &frame) {
+  frame.subsystem = subsystem;
+  frame.innerRetained = 0;
+  frame.nested = CURRENT_TASK() == ownerTask;
+  frame.parent = frame.nested ? current : nullptr;
+  if (frame.nested) current = &frame;
+  frame.freeAtEntry = freeBytes();
+}
+
+void HeapAccounting::exit(HeapScopeFrame &frame) {
+  int32_t retained = (int32_t)frame.freeAtEntry - (int32_t)freeBytes();
+  int32_t own = retained - frame.innerRetained;
+
+  STATS_LOCK();
+  SubsystemHeap &s = stats[(size_t)frame.subsystem];
+  s.calls++;
+  s.liveBytes += own;
+  if (s.liveBytes > s.peakBytes) s.peakBytes = s.liveBytes;
+  if (own > 0) {
+    s.grownBytes += own;
+    grownSinceSample += own;
+  }
+  STATS_UNLOCK();
+
+  if (frame.nested) {
+    current = frame.parent;
+    if (current) current->innerRetained += retained;
+  }
+}
+
+// ==================== History & leaks ====================
+void HeapAccounting::sample(uint32_t uptimeMs) {
+  if (historyCount && uptimeMs - lastSampleMs < HEAP_SAMPLE_INTERVAL) return;
+  lastSampleMs = uptimeMs;
+
+  HeapSample &entry = history[historyHead];
+  entry.uptimeMs = uptimeMs;
+  entry.freeBytes = freeBytes();
+  entry.largestBlock = largestFreeBlock();
+  STATS_LOCK();
+  entry.grownBytes = grownSinceSample;
+  grownSinceSample = 0;
+  STATS_UNLOCK();
+
+  historyHead = (historyHead + 1) % HEAP_HISTORY_LEN;
+  if (historyCount < HEAP_HISTORY_LEN) historyCount++;
+}
+
+void HeapAccounting::markCycle(HeapCycle cycle) {
+  size_t c = (size_t)cycle;
+  size_t slot = cycleMarks[c] % HEAP_CYCLE_HISTORY;
+  cycleFree[c][slot] = freeBytes();
+  for (size_t s = 0; s < (size_t)Subsystem::Count; s++) cycleLive[c][slot][s] = stats[s].liveBytes;
+  cycleMarks[c]++;
+}
+
+// Free heap never recovered across a full window of cycles and dropped meaningfully
+bool HeapAccounting::leakSuspected(HeapCycle cycle) const {
+  size_t c = (size_t)cycle;
+  if (cycleMarks[c] < HEAP_CYCLE_HISTORY) return false;
+
+  size_t oldest = cycleMarks[c] % HEAP_CYCLE_HISTORY;
+  uint32_t previous = cycleFree[c][oldest];
+  for (size_t i = 1; i < HEAP_CYCLE_HISTORY; i++) {
+    uint32_t next = cycleFree[c][(oldest + i) % HEAP_CYCLE_HISTORY];
+    if (next > previous) return false;
+    previous = next;
+  }
+  return cycleFree[c][oldest] - previous >= HEAP_LEAK_MIN_BYTES;
+}
+
+std::string HeapAccounting::reportJson() const {
+  char buf[160];
+  std::string json;
+  size_t freeNow = freeBytes();
+  size_t largest = largestFreeBlock();
+
+  snprintf(buf, sizeof(buf), "{\"free\":%u,\"largest_block\":%u,\"fragmentation_pct\":%u,\"subsystems\":{",
+           (unsigned)freeNow, (unsigned)largest, freeNow ? (unsigned)(100 - largest * 100 / freeNow) : 0);
+  json += buf;
+
+  for (size_t s = 0; s < (size_t)Subsystem::Count; s++) {
+    snprintf(buf, sizeof(buf), "%s\"%s\":{\"live\":%d,\"peak\":%d,\"grown\":%u,\"calls\":%u}", s ? "," : "",
+             SUBSYSTEM_NAMES[s], (int)stats[s].liveBytes, (int)stats[s].peakBytes, (unsigned)stats[s].grownBytes,
+             (unsigned)stats[s].calls);
+    json += buf;
+  }
+  json += "},\"cycles\":{";
+
+  for (size_t c = 0; c < (size_t)HeapCycle::Count; c++) {
+    snprintf(buf, sizeof(buf), "%s\"%s\":{\"count\":%u,\"leak\":%s,\"suspects\":[", c ? "," : "", CYCLE_NAMES[c],
+             (unsigned)cycleMarks[c], leakSuspected((HeapCycle)c) ? "true" : "false");
+    json += buf;
+
+    // Subsystems whose retained bytes grew at every mark in the window
+    bool first = true;
+    if (cycleMarks[c] >= HEAP_CYCLE_HISTORY) {
+      size_t oldest = cycleMarks[c] % HEAP_CYCLE_HISTORY;
+      for (size_t s = 0; s < (size_t)Subsystem::Count; s++) {
+        bool growing = true;
+        for (size_t i = 1; i < HEAP_CYCLE_HISTORY && growing; i++) {
+          growing = cycleLive[c][(oldest + i) % HEAP_CYCLE_HISTORY][s] >
+                    cycleLive[c][(oldest + i - 1) % HEAP_CYCLE_HISTORY][s];
+        }
+        if (!growing) continue;
+        json += first ? "\"" : ",\"";
+        json += SUBSYSTEM_NAMES[s];
+        json += "\"";
+        first = false;
+      }
+    }
+    json += "]}";
+  }
+  json += "},\"history\":[";
+
+  // Oldest first: [uptime_ms, free, largest_block, grown_bytes]
+  for (size_t i = 0; i < historyCount; i++) {
+    const HeapSample &e = history[(historyHead + HEAP_HISTORY_LEN - historyCount + i) % HEAP_HISTORY_LEN];
+    snprintf(buf, sizeof(buf), "%s[%u,%u,%u,%u]", i ? "," : "", (unsigned)e.uptimeMs, (unsigned)e.freeBytes,
+             (unsigned)e.largestBlock, (unsigned)e.grownBytes);
+    json += buf;
+  }
+  json += "]}";
+  return json;
+}
@@ -0,0 +1,93 @@
+#ifndef HEAP_ACCOUNTING_H
+#define HEAP_ACCOUNTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define HEAP_HISTORY_LEN 32          // Heap samples kept for the trend
+#define HEAP_SAMPLE_INTERVAL 60000UL  // 1 minute between samples
+#define HEAP_CYCLE_HISTORY 6          // Marks per cycle kind used for leak detection
+#define HEAP_LEAK_MIN_BYTES 256       // Net loss over the window before a leak is reported
+
+struct HeapScopeFrame;
+
+enum class Subsystem : uint8_t { BLE, REST, MQTT, Notify, UI, K230D, Count };
+enum class HeapCycle : uint8_t { Unlock, Count };  // Marks live in RAM, so only cycles that repeat within a boot
+
+struct SubsystemHeap {
+  int32_t liveBytes;    // Net bytes retained after this subsystem's scopes returned
+  int32_t peakBytes;    // Highest liveBytes seen
+  uint32_t grownBytes;  // Sum of scope exits that left the heap smaller
+  uint32_t calls;
+};
+
+struct HeapSample {
+  uint32_t uptimeMs;
+  uint32_t freeBytes;
+  uint32_t largestBlock;
+  uint32_t grownBytes;  // All subsystems, since the previous sample
+};
+
+// Attributes heap growth to subsystems by sampling free heap around HEAP_SCOPE blocks.
+// Nested scopes only charge the outer subsystem for what the inner one did not keep.
+// Scopes on other tasks run unnested, so concurrent allocations can blur their numbers.
+class HeapAccounting {
+public:
+  HeapAccounting();
+
+  void begin();  // Call from loop()'s task, which becomes the one scopes nest on
+  void enter(Subsystem subsystem, HeapScopeFrame &frame);
+  void exit(HeapScopeFrame &frame);
+
+  void sample(uint32_t uptimeMs);  // Periodic heap/fragmentation history
+  void markCycle(HeapCycle cycle);  // End of a repeatable cycle, feeds leak detection
+
+  const SubsystemHeap &subsystem(Subsystem s) const { return stats[(size_t)s]; }
+  bool leakSuspected(HeapCycle cycle) const;
+  std::string reportJson() const;
+
+  // Heap source, swapped out by host builds
+  static size_t freeBytes();
+  static size_t largestFreeBlock();
+
+private:
+  SubsystemHeap stats[(size_t)Subsystem::Count];
+  HeapSample history[HEAP_HISTORY_LEN];
+  size_t historyHead;
+  size_t historyCount;
+  uint32_t grownSinceSample;
+  uint32_t lastSampleMs;
+
+  uint32_t cycleFree[(size_t)HeapCycle::Count][HEAP_CYCLE_HISTORY];
+  int32_t cycleLive[(size_t)HeapCycle::Count][HEAP_CYCLE_HISTORY][(size_t)Subsystem::Count];
+  uint32_t cycleMarks[(size_t)HeapCycle::Count];
+
+  HeapScopeFrame *current;  // Innermost scope on the owning task
+  void *ownerTask;
+};
+
+struct HeapScopeFrame {
+  Subsystem subsystem;
+  size_t freeAtEntry;
+  int32_t innerRetained;  // Already charged to nested scopes
+  HeapScopeFrame *parent;
+  bool nested;
+};
+
+extern HeapAccounting heapAccounting;
+
+class HeapScope {
+public:
+  explicit HeapScope(Subsystem subsystem) { heapAccounting.enter(subsystem, frame); }
+  ~HeapScope() { heapAccounting.exit(frame); }
+
+private:
+  HeapScopeFrame frame;
+};
+
+#define HEAP_SCOPE_CONCAT(a, b) a##b
+#define HEAP_SCOPE_NAME(line) HEAP_SCOPE_CONCAT(heapScope, line)
+#define HEAP_SCOPE(subsystem) HeapScope HEAP_SCOPE_NAME(__LINE__)(Subsystem::subsystem)
+
+#endif  // HEAP_ACCOUNTING_H
@@ -0,0 +1,144 @@
+#include "json_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t BLOCK_HEADER = 8;  // Keeps every block 8-byte aligned
+static const size_t NO_BLOCK = SIZE_MAX;
+
+static size_t alignUp(size_t n) { return (n + 7) & ~(size_t)7; }
+
+// Used when every slot is taken or a payload outgrows its slot, so it still parses instead of failing
+class HeapAllocator : public ArduinoJson::Allocator {
+public:
+  void *allocate(size_t size) override { return malloc(size); }
+  void deallocate(void *ptr) override { free(ptr); }
+  void *reallocate(void *ptr, size_t newSize) override { return realloc(ptr, newSize); }
+};
+
+static HeapAllocator heapAllocator;
+
+// ==================== JsonArena ====================
+JsonArena::JsonArena(uint8_t *buffer, size_t capacity)
+    : buffer(buffer), size(capacity), offset(0), lastBlock(NO_BLOCK), peak(0), heapBlocks(0) {}
+
+void JsonArena::reset() {
+  offset = 0;
+  lastBlock = NO_BLOCK;
+}
+
+void *JsonArena::allocate(size_t bytes) {
+  size_t needed = BLOCK_HEADER + alignUp(bytes);
+  if (offset + needed > size) {
+    heapBlocks++;
+    return heapAllocator.allocate(bytes);
+  }
+
+  uint8_t *header = buffer + offset;
+  memcpy(header, &bytes, sizeof(bytes));
+  lastBlock = offset;
+  offset += needed;
+  if (offset > peak) peak = offset;
+  return header + BLOCK_HEADER;
+}
+
+void JsonArena::deallocate(void *ptr) {
+  if (!ptr) return;
+  if (!owns(ptr)) return heapAllocator.deallocate(ptr);
+  // Only the newest block can be returned; the rest is reclaimed by reset()
+  uint8_t *header = (uint8_t *)ptr - BLOCK_HEADER;
+  if (lastBlock != NO_BLOCK && header == buffer + lastBlock) {
+    offset = lastBlock;
+    lastBlock = NO_BLOCK;
+  }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+  if (!owns(ptr)) return heapAllocator.reallocate(ptr, newSize);
+
+  uint8_t *header = (uint8_t *)ptr - BLOCK_HEADER;
+  size_t oldSize;
+  memcpy(&oldSize, header, sizeof(oldSize));
+
+  if (lastBlock != NO_BLOCK && header == buffer + lastBlock) {
+    // Newest block: grow or shrink in place
+    size_t end = lastBlock + BLOCK_HEADER + alignUp(newSize);
+    if (end <= size) {
+      memcpy(header, &newSize, sizeof(newSize));
+      offset = end;
+      if (offset > peak) peak = offset;
+      return ptr;
+    }
+  } else if (newSize <= oldSize) {
+    return ptr;  // Shrinking an older block keeps its slack
+  }
+
+  // Copy out, then hand the newest block's space back, which is a no-op for older blocks
+  void *moved = allocate(newSize);
+  if (!moved) return nullptr;
+  memcpy(moved, ptr, oldSize);
+  deallocate(ptr);
+  return moved;
+}
+
+bool JsonArena::owns(const void *ptr) const {
+  return (const uint8_t *)ptr >= buffer && (const uint8_t *)ptr < buffer + size;
+}
+
+// ==================== JsonDocumentPool ====================
+JsonDocumentPool::JsonDocumentPool() : acquired(0), fallbacks(0) {
+  for (size_t i = 0; i < JSON_POOL_SLOTS; i++) {
+    arenas[i] = new JsonArena(storage[i], JSON_POOL_SLOT_SIZE);  // Allocated once at first use
+    inUse[i].store(false);
+  }
+}
+
+JsonDocumentPool &JsonDocumentPool::instance() {
+  static JsonDocumentPool pool;
+  return pool;
+}
+
+JsonArena *JsonDocumentPool::acquire() {
+  // Lock-free claim: loop() and the BLE callback task both parse
+  for (size_t i = 0; i < JSON_POOL_SLOTS; i++) {
+    bool expected = false;
+    if (inUse[i].compare_exchange_strong(expected, true)) {
+      acquired++;
+      return arenas[i];
+    }
+  }
+  fallbacks++;
+  return nullptr;
+}
+
+void JsonDocumentPool::release(JsonArena *arena) {
+  if (!arena) return;
+  for (size_t i = 0; i < JSON_POOL_SLOTS; i++) {
+    if (arenas[i] == arena) {
+      arena->reset();
+      inUse[i].store(false);
+      return;
+    }
+  }
+}
+
+JsonPoolStats JsonDocumentPool::stats() const {
+  JsonPoolStats s = {acquired.load(), fallbacks.load(), 0};
+  for (size_t i = 0; i < JSON_POOL_SLOTS; i++) {
+    s.fallbacks += arenas[i]->overflows();
+    if (arenas[i]->highWater() > s.highWater) s.highWater = arenas[i]->highWater();
+  }
+  return s;
+}
+
+// ==================== JsonPoolSlot ====================
+ArduinoJson::Allocator *JsonPoolSlot::slotAllocator() const {
+  if (arena) return arena;
+  return &heapAllocator;
+}
+
+JsonDocument makeJsonFilter(std::initializer_list<const char *> fields) {
+  JsonDocument filter;
+  for (const char *field : fields) filter[field] = true;
+  return filter;
+}
@@ -0,0 +1,95 @@
+#ifndef JSON_POOL_H
+#define JSON_POOL_H
+
+#include <ArduinoJson.h>
+#include <atomic>
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pool sizing, override from build_flags if a handler needs more room
+#ifndef JSON_POOL_SLOTS
+#define JSON_POOL_SLOTS 4  // loop() handlers + BLE callback task can hold a document at the same time
+#endif
+#ifndef JSON_POOL_SLOT_SIZE
+#define JSON_POOL_SLOT_SIZE 3072  // Inbound messages and commissioning with a short JWT, longer ones overflow to the heap
+#endif
+
+// Bump allocator over a fixed buffer. ArduinoJson grows strings by reallocating the
+// most recent block, so that case is resized in place instead of copied. A block that
+// doesn't fit goes to the heap, so an oversized payload still parses.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  JsonArena(uint8_t *buffer, size_t capacity);
+
+  void *allocate(size_t size) override;
+  void deallocate(void *ptr) override;
+  void *reallocate(void *ptr, size_t newSize) override;
+
+  void reset();
+  size_t used() const { return offset; }
+  size_t highWater() const { return peak; }
+  size_t capacity() const { return size; }
+  uint32_t overflows() const { return heapBlocks; }
+
+private:
+  bool owns(const void *ptr) const;
+
+  uint8_t *buffer;
+  size_t size;
+  size_t offset;
+  size_t lastBlock;  // Offset of the most recent block header, SIZE_MAX if none
+  size_t peak;
+  uint32_t heapBlocks;  // Blocks that didn't fit in the buffer
+};
+
+struct JsonPoolStats {
+  uint32_t acquired;   // Documents served from the pool
+  uint32_t fallbacks;  // Pool exhausted or a slot overflowed, allocations went to the heap
+  size_t highWater;    // Largest arena usage seen in any slot
+};
+
+// Fixed set of arenas shared by all inbound parsing paths
+class JsonDocumentPool {
+public:
+  static JsonDocumentPool &instance();
+
+  JsonArena *acquire();
+  void release(JsonArena *arena);
+  JsonPoolStats stats() const;
+
+private:
+  JsonDocumentPool();
+
+  alignas(8) uint8_t storage[JSON_POOL_SLOTS][JSON_POOL_SLOT_SIZE];
+  JsonArena *arenas[JSON_POOL_SLOTS];
+  std::atomic<bool> inUse[JSON_POOL_SLOTS];
+  std::atomic<uint32_t> acquired;
+  std::atomic<uint32_t> fallbacks;
+};
+
+// Owns a pool slot for the lifetime of a PooledJsonDocument
+class JsonPoolSlot {
+public:
+  JsonPoolSlot() : arena(JsonDocumentPool::instance().acquire()) {}
+  ~JsonPoolSlot() { JsonDocumentPool::instance().release(arena); }
+  JsonPoolSlot(const JsonPoolSlot &) = delete;
+  JsonPoolSlot &operator=(const JsonPoolSlot &) = delete;
+
+  ArduinoJson::Allocator *slotAllocator() const;
+
+private:
+  JsonArena *arena;
+};
+
+// Drop-in replacement for a stack JsonDocument. The slot base is constructed first and
+// destroyed last, so the arena is only handed back after the document has released it.
+class PooledJsonDocument : private JsonPoolSlot, public JsonDocument {
+public:
+  PooledJsonDocument() : JsonPoolSlot(), JsonDocument(JsonPoolSlot::slotAllocator()) {}
+};
+
+// Builds a DeserializationOption::Filter document that keeps only the named top-level fields
+JsonDocument makeJsonFilter(std::initializer_list<const char *> fields);
+
+#endif  // JSON_POOL_H
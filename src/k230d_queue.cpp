@@ -0,0 +1,180 @@
+#include "k230d_queue.h"
+#include "json_pool.h"
+
+K230DQueue::K230DQueue()
+    : port(nullptr), entries(), nextId(1), powered(false), ready(false), acksSupported(false), rescued(false),
+      blindFlush(false), wire(WireFormat::Json), poweredMs(0), enqueued(0), delivered(0), failed(0), unconfirmed(0),
+      resends(0), batches(0), batchedCommands(0), blindFlushes(0), powerCycles(0), cyclesAvoided(0), latency() {}
+
+void K230DQueue::begin(Print &out) { port = &out; }
+
+void K230DQueue::powerOn() {
+  powered = true;
+  ready = false;
+  acksSupported = false;
+  rescued = false;
+  wire = WireFormat::Json;
+  poweredMs = millis();
+  powerCycles++;
+}
+
+void K230DQueue::awake(WireFormat format, bool acks) {
+  if (!powered) return;
+  wire = format;
+  acksSupported = acks;
+  ready = true;
+  flush();
+}
+
+uint16_t K230DQueue::enqueue(const String &json) {
+  Entry *slot = nullptr;
+  for (Entry &entry : entries) {
+    if (!entry.id) {
+      slot = &entry;
+      break;
+    }
+  }
+  if (!slot || !json.startsWith("{")) {
+    failed++;
+    return 0;
+  }
+
+  uint16_t id = nextId++;
+  if (!nextId) nextId = 1;
+  slot->id = id;
+  slot->attempts = 0;
+  slot->held = !ready;
+  slot->sentMs = 0;
+  slot->json = "{\"id\":" + String(id) + (json.length() > 2 ? "," : "") + json.substring(1);
+  enqueued++;
+  if (ready) flush();
+  return id;
+}
+
+void K230DQueue::append(String &batch, const String &json) {
+  if (wire == WireFormat::MsgPack) {
+    PooledJsonDocument doc;
+    uint8_t frame[K230D_FRAME_MAX];
+    size_t length = deserializeJson(doc, json.c_str(), json.length()) ? 0 : wireFrame(doc, frame, sizeof(frame));
+    if (length) {
+      batch.concat((const char *)frame, length);
+      return;
+    }
+  }
+  batch += json;
+  batch += '\n';
+}
+
+// Everything not yet sent goes out in one write, so the K230D sees a single burst
+void K230DQueue::flush() {
+  String batch;
+  uint32_t count = 0;
+  unsigned long now = millis();
+  for (Entry &entry : entries) {
+    if (!entry.id || entry.attempts) continue;
+    append(batch, entry.json);
+    entry.attempts = 1;
+    entry.sentMs = now;
+    count++;
+  }
+  if (!count || !port) return;
+  port->write((const uint8_t *)batch.c_str(), batch.length());
+  batches++;
+  batchedCommands += count;
+
+  // Without acks a send to an awake K230D is as good as it gets
+  if (acksSupported) return;
+  for (Entry &entry : entries) {
+    if (entry.id && entry.attempts) release(entry, blindFlush ? Outcome::Unconfirmed : Outcome::Delivered);
+  }
+}
+
+void K230DQueue::ack(uint16_t id, bool ok) {
+  for (Entry &entry : entries) {
+    if (entry.id != id || !entry.attempts) continue;
+    uint32_t ms = millis() - entry.sentMs;  // From the latest send
+    latency.count++;
+    latency.totalMs += ms;
+    if (ms > latency.maxMs) latency.maxMs = ms;
+    release(entry, ok ? Outcome::Delivered : Outcome::Failed);  // A rejected command is not resent
+    return;
+  }
+}
+
+void K230DQueue::release(Entry &entry, Outcome outcome) {
+  switch (outcome) {
+    case Outcome::Delivered:
+      delivered++;
+      if (entry.held || entry.attempts > 1) rescued = true;
+      break;
+    case Outcome::Failed:
+      failed++;
+      break;
+    case Outcome::Unconfirmed:
+      unconfirmed++;
+      break;
+  }
+  entry.id = 0;
+  entry.json = String();
+}
+
+void K230DQueue::poll() {
+  if (!powered) return;
+  unsigned long now = millis();
+
+  if (!ready) {
+    if (now - poweredMs < K230D_BOOT_TIMEOUT_MS) return;
+    blindFlush = true;
+    blindFlushes++;
+    ready = true;
+    flush();
+    blindFlush = false;
+    return;
+  }
+  if (!acksSupported) return;
+
+  for (Entry &entry : entries) {
+    if (!entry.id || !entry.attempts || now - entry.sentMs < K230D_ACK_TIMEOUT_MS) continue;
+    if (entry.attempts >= K230D_MAX_ATTEMPTS) {
+      release(entry, Outcome::Failed);
+      continue;
+    }
+    String batch;
+    append(batch, entry.json);
+    if (port) port->write((const uint8_t *)batch.c_str(), batch.length());
+    entry.attempts++;
+    entry.sentMs = now;
+    resends++;
+  }
+}
+
+void K230DQueue::powerOff() {
+  for (Entry &entry : entries) {
+    if (entry.id) release(entry, Outcome::Failed);
+  }
+  if (rescued) cyclesAvoided++;
+  powered = false;
+  ready = false;
+}
+
+bool K230DQueue::awaitingAcks() const {
+  if (!acksSupported) return false;
+  for (const Entry &entry : entries) {
+    if (entry.id && entry.attempts) return true;
+  }
+  return false;
+}
+
+String K230DQueue::statsJson() const {
+  uint32_t settled = delivered + failed;
+  return "{\"power_cycles\":" + String(powerCycles) + ",\"cycles_avoided\":" + String(cyclesAvoided) +
+         ",\"enqueued\":" + String(enqueued) + ",\"delivered\":" + String(delivered) + ",\"failed\":" +
+         String(failed) + ",\"unconfirmed\":" + String(unconfirmed) +
+         ",\"success_pct\":" + String(settled ? delivered * 100 / settled : 0) + ",\"resends\":" + String(resends) +
+         ",\"batches\":" + String(batches) +
+         ",\"avg_batch\":" + String(batches ? (float)batchedCommands / batches : 0.0f, 1) +
+         ",\"blind_flushes\":" + String(blindFlushes) + ",\"acks\":" + String(acksSupported ? "true" : "false") +
+         ",\"wire\":\"" + wireFormatName(wire) + "\",\"ack_latency\":{\"count\":" + String(latency.count) +
+         ",\"avg_ms\":" + String(latency.count ? (uint32_t)(latency.totalMs / latency.count) : 0) +
+         ",\"max_ms\":" + String(latency.maxMs) + "}}";
+}
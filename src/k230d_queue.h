@@ -0,0 +1,79 @@
+#ifndef K230D_QUEUE_H
+#define K230D_QUEUE_H
+
+#include <Arduino.h>
+
+#include "wire.h"
+
+#define K230D_QUEUE_SIZE 8           // Commands held or awaiting an ack in one power-on window
+#define K230D_BOOT_TIMEOUT_MS 2500UL // Flush without an awake status after this, for firmware that never sends one
+#define K230D_ACK_TIMEOUT_MS 300UL   // Resend a command not acked within this
+#define K230D_MAX_ATTEMPTS 3         // Sends per command within one power-on window
+#define K230D_ACK_GRACE_MS 2000UL    // Most the uptime budget is extended while acks are outstanding
+#define K230D_FRAME_MAX 512
+
+struct K230DAckLatency {
+  uint32_t count;
+  uint64_t totalMs;
+  uint32_t maxMs;
+};
+
+// Holds lock-to-K230D commands while the module boots and flushes them as one UART burst
+// when it reports awake. Each command carries an ID; a K230D that advertises "acks" in its
+// awake status acks them, and unacked ones are resent until the window closes.
+class K230DQueue {
+public:
+  K230DQueue();
+
+  void begin(Print &port);
+  void powerOn();
+  void awake(WireFormat format, bool acks);  // Awake status, flushes the held batch
+  uint16_t enqueue(const String &json);      // Returns the command ID, 0 if the queue is full
+  void ack(uint16_t id, bool ok);
+  void poll();                               // Boot timeout and resends
+  void powerOff();                           // Commands still pending count as failed
+
+  bool isAwake() const { return ready; }
+  bool awaitingAcks() const;
+  String statsJson() const;
+
+private:
+  enum class Outcome : uint8_t { Delivered, Failed, Unconfirmed };
+
+  struct Entry {
+    uint16_t id;  // 0 marks a free slot
+    uint8_t attempts;
+    bool held;    // Queued before the K230D was awake
+    unsigned long sentMs;
+    String json;  // Includes the "id" field
+  };
+
+  void flush();
+  void append(String &batch, const String &json);
+  void release(Entry &entry, Outcome outcome);
+
+  Print *port;
+  Entry entries[K230D_QUEUE_SIZE];
+  uint16_t nextId;
+  bool powered;
+  bool ready;
+  bool acksSupported;
+  bool rescued;     // A held or resent command got through in this window
+  bool blindFlush;  // Flushing on the boot timeout, sends can't be confirmed
+  WireFormat wire;
+  unsigned long poweredMs;
+
+  uint32_t enqueued;
+  uint32_t delivered;
+  uint32_t failed;
+  uint32_t unconfirmed;  // Sent on a blind flush to firmware without acks
+  uint32_t resends;
+  uint32_t batches;
+  uint32_t batchedCommands;
+  uint32_t blindFlushes;  // Boot timeouts that flushed without an awake status
+  uint32_t powerCycles;
+  uint32_t cyclesAvoided;  // Windows where the queue delivered what a send at power-on would have lost
+  K230DAckLatency latency;
+};
+
+#endif  // K230D_QUEUE_H
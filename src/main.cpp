@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <ESPmDNS.h>
 #include <HTTPClient.h>
 #include <PubSubClient.h>
 #include <WebServer.h>
@@ -11,8 +12,21 @@
 #include <TFT_eSPI.h>
 #include <esp_wifi.h>
 
+#include "battery.h"
 #include "ble_server.h"
+#include "commands.h"
+#include "credentials.h"
+#include "energy.h"
 #include "esp_bt.h"
+#include "face_gallery.h"
+#include "heap_accounting.h"
+#include "json_pool.h"
+#include "k230d_queue.h"
+#include "ota.h"
+#include "power_manager.h"
+#include "snapshot.h"
+#include "stall_monitor.h"
+#include "wire.h"
 
 // --- Pins (As specified) ---
 #define LOCK_PIN 39
@@ -39,10 +53,10 @@ const char *register_lock_endpoint =
 #define LOCK_MODEL "JUPY Block Pro"                     // Lock Model
 #define FIRMWARE_VERSION "v1.0"                         // Firmware version
 #define PAIRING_CODE "123456"                           // Lock Pairing Code
-#define AUTH_DISABLE_TIME 30 * 60000UL                  // 30 minutes
 #define COMMISSION_TIME 10 * 60000UL                    // 10 minutes
 #define MQTT_ACTIVE_TIMEOUT 2 * 60000UL                 // 2 minutes
 #define K230D_MAX_UPTIME 3000UL                         // 3 seconds
+#define UART_LINE_MAX 512                               // Longest K230D status line
 
 // --- Instances ---
 TFT_eSPI tft = TFT_eSPI();
@@ -53,6 +67,12 @@ WebServer localServer(80);
 // MatterDoorLock doorLock;
 Preferences prefs;
 BLECommissioningServer bleServer;
+BatteryMonitor battery;
+CommandLog commandLog;
+FaceGallery faceGallery;
+SnapshotRelay snapshot;
+OtaUpdater ota;
+K230DQueue k230Queue;
 
 // --- Stored Variables ---
 String LOCK_NAME = "";
@@ -61,40 +81,53 @@ String USER_ID = "";
 
 // --- State Management ---
 bool mqttActive = false;
-unsigned long authTimeout = 0;
 unsigned long bootTime = 0;
 unsigned long commissionTimeout = 0;
 unsigned long faceUnlockTimeout = 0;
 unsigned long lastActivity = 0;
-unsigned long k230StartTime = 0;
+unsigned long k230PoweredAt = 0;
+unsigned long k230StartTime = 0;  // Uptime budget start, held at now until the K230D is awake
 unsigned long k230UpTime = 0;
-unsigned long lastBatCheck = 0;
 
 bool k230IsRunning = false;
 bool pinManuallyEntered = false;
 bool share_analytics = false;
 bool notify_motion = false;
+bool otaUploadOk = false;
 
 uint8_t intruder = 0;
-uint8_t authFail = 0;
 String passcodeBuffer = "";
+String deferredUnlock = "";  // Source of an acked unlock command still to be run
+
+char uartLine[UART_LINE_MAX];  // K230D line assembled in place, no String copy
+size_t uartLineLen = 0;
+bool uartLineOverflow = false;
+size_t uartFrameLen = 0;      // Payload length of the MessagePack frame being read, 0 while reading text
+uint8_t uartFrameHeader = 0;  // Length bytes still expected after a frame marker
+size_t uartFrameSkip = 0;     // Bytes left of an oversized frame being dropped
+
 
 // Function Prototypes
 void handlePIR();
 void handleUART();
+void handleK230DMessage(const char *, size_t, WireFormat = WireFormat::Json);
 void handleTouch();
 void handleTimeouts();
 void monitorBattery();
+void trackEnergy();
 void initialCommisioning();
 void connectToWifi(const String &ssid, const String &password);
 void wakeK230D(String command = "{\"cmd\":\"on\"}");
+void relaySnapshot();
 
 bool checkPin(const char *);
 void unlockDoor(String);
+void runDeferredUnlock();
 void drawKeypad();
 void FCM_Notification(String, String);
 void setupREST();
 void serverLog(String);
+bool mqttPublish(const String &, const String &, WireFormat = WireFormat::Json);
 void mqttCallback(char *, byte *, unsigned int);
 void reconnectMQTT();
 void endMQTTSession();
@@ -118,15 +151,26 @@ void wakeUpReason() {
   }
 }
 
+// Test builds link this file for the on-target benchmarks, which bring their own setup() and loop()
+#ifndef UNIT_TEST
 void setup() {
   Serial.begin(115200);
+  heapAccounting.begin();
+  energyLedger.begin();
 
   wakeUpReason();
+  ota.checkHealthOnBoot(FIRMWARE_VERSION);  // May roll back and restart before anything else runs
   pinMode(PIR_PIN, INPUT);
   pinMode(LOCK_PIN, OUTPUT);
   pinMode(K230D_PWR_PIN, OUTPUT);
   pinMode(BATTERY_PIN, INPUT);
   pinMode(BUTTON_PIN, INPUT);
+  pinMode(T_IRQ, INPUT_PULLUP);
+  battery.begin(BATTERY_PIN);
+  battery.update();  // Seed the cached level served by /status
+  if (!faceGallery.begin()) Serial.println("Face gallery unavailable. K230D will match faces itself.");
+  snapshot.begin();
+  k230Queue.begin(Serial);
 
   digitalWrite(LOCK_PIN, HIGH);      // Fail-secure: HIGH usually keeps locked
   digitalWrite(K230D_PWR_PIN, LOW);  // K230D off by default
@@ -134,14 +178,17 @@ void setup() {
   tft.init();
   tft.setRotation(1);
   drawKeypad();
+  energyLedger.set(EnergyConsumer::Display, EnergyState::Active);
 
   // 0. Initialize Storage
   prefs.begin("my_storage", false);
+  credentials.begin();
   prefs.putString("pairing_code", PAIRING_CODE);
 
   // 1. Matter/BLE Provisioning & Transition
   Serial.println("Check for commsioning");
   initialCommisioning();
+  if (bleServer.beginProximity("JUPY Lock Pro")) Serial.println("BLE proximity unlock enabled");
 
   // 2. Local REST API
   Serial.println("Setup Rest Server");
@@ -151,9 +198,21 @@ void setup() {
   Serial.println("===========================\n");
   mqttClient.setServer(mqtt_server, 1883);
   mqttClient.setCallback(mqttCallback);
+  mqttClient.setBufferSize(2048);  // Default 256 bytes drops diagnostics and status logs
+
+  stallMonitor.begin();  // After setup so commissioning waits are not counted
+  stallMonitor.onReset([]() { energyLedger.flush(); });  // flush() takes the ledger lock, loop() may be mid-update
+  powerManager.begin(PIR_PIN, BUTTON_PIN, T_IRQ);
 }
 
 void loop() {
+  // UART links lose bytes in light sleep, so stay up while the K230D or an image transfer is active
+  powerManager.stayAwake(k230IsRunning || snapshot.busy() || ota.active());
+  powerManager.waitForEvent();
+
+  STALL_SCOPE("loop");
+  heapAccounting.sample(millis());
+  powerManager.handled(WakeSource::Button);
   if (digitalRead(BUTTON_PIN)) {
     unlockDoor("Manual");
   }
@@ -161,20 +220,35 @@ void loop() {
   handlePIR();
   handleUART();
   handleTouch();
+  if (snapshot.poll()) relaySnapshot();
   monitorBattery();
+  trackEnergy();
   localServer.handleClient();
+  ota.poll();
+  if (mqttActive && mqttClient.connected() && ota.takeFailure()) serverLog(ota.statusJson());
+  bleServer.poll();
+  if (bleServer.takeUnlock()) {
+    powerManager.handled(WakeSource::BLE);
+    unlockDoor("BLE Proximity");
+  }
+  ota.confirmHealthy(WiFi.status() == WL_CONNECTED);
 
   if (mqttActive) {
     if (!mqttClient.connected()) reconnectMQTT();
     mqttClient.loop();
   }
+  runDeferredUnlock();
 
   handleTimeouts();
 }
+#endif  // UNIT_TEST
 
 // --- CORE LOGIC FUNCTIONS ---
 
 void handlePIR() {
+  STALL_SCOPE("handlePIR");
+  HEAP_SCOPE(K230D);
+  powerManager.handled(WakeSource::PIR);
   if (digitalRead(PIR_PIN) == HIGH && !k230IsRunning) {
     delay(50);  // Debounce
     if (notify_motion) FCM_Notification("Motion Detected", "Waking up Vision System...");
@@ -183,13 +257,26 @@ void handlePIR() {
 }
 
 void wakeK230D(String command) {
-  digitalWrite(K230D_PWR_PIN, HIGH);
+  STALL_SCOPE("wakeK230D");
+  HEAP_SCOPE(K230D);
+  if (!k230IsRunning) {
+    digitalWrite(K230D_PWR_PIN, HIGH);
+    k230Queue.powerOn();
+    k230PoweredAt = millis();
+  }
   if (faceUnlockTimeout) {
     command.replace("}", ", \"face_timeout\": true }");
     // Disable camera on start up and skip face recog code,
     // but if doorbell request then enable camera on K230D side
   }
-  Serial.println(command);
+  if (faceGallery.enabled()) {
+    command.replace("}", ", \"embed\": true }");
+    // K230D streams the embedding and powers down, matching happens here
+  }
+  // Lets the K230D frame its replies as MessagePack; old firmware ignores it. The command is held until
+  // awake, so the awake status itself is always JSON and carries the K230D's own "wire" offer
+  command.replace("}", ", \"wire\": \"msgpack\" }");
+  k230Queue.enqueue(command);  // Held until the K230D reports awake, a line sent while it boots is lost
   k230StartTime = millis();
   k230IsRunning = true;
 }
@@ -197,6 +284,13 @@ void wakeK230D(String command) {
 void K230DPowerOff() {
   digitalWrite(K230D_PWR_PIN, LOW);
   k230IsRunning = false;
+  k230Queue.powerOff();
+  // A frame or line cut off by the power-off must not swallow the first bytes of the next boot
+  uartLineLen = 0;
+  uartLineOverflow = false;
+  uartFrameLen = 0;
+  uartFrameHeader = 0;
+  uartFrameSkip = 0;
   serverLog("{\"event\": \"power_off\", \"uptime\": \"" + String(k230UpTime / 1000) + "\"}");
   k230UpTime = 0;
   Serial.println("K230D Powered Off.");
@@ -225,18 +319,12 @@ void startDeepSleep(unsigned long milli_sec = 0) {
   // 3. Timer wakeup if time given else pin interrupt wakeup
   if (milli_sec > 0) esp_sleep_enable_timer_wakeup(milli_sec * 1000ULL);
 
+  energyLedger.flush();
   Serial.println("Entering Deep Sleep now...");
   esp_deep_sleep_start();
 }
 
 void handleTimeouts() {
-  if (authTimeout) {
-    if (millis() >= authTimeout + AUTH_DISABLE_TIME) {
-      authTimeout = 0;
-      authFail = 0;
-    }
-  }
-
   if (mqttActive) {
     // Auto-disable MQTT after 2 minutes of no remote commands to save battery
     if (millis() - lastActivity > MQTT_ACTIVE_TIMEOUT) {
@@ -245,7 +333,12 @@ void handleTimeouts() {
   }
 
   // K230D Power Management (3s x 3 = 9s timeout logic)
-  if (k230IsRunning && (millis() - k230StartTime > K230D_MAX_UPTIME)) {
+  // The budget starts once the held commands go out (awake status or boot timeout), not at power-on.
+  // Outstanding acks extend it by up to K230D_ACK_GRACE_MS so resends land in this power-on window
+  k230Queue.poll();
+  if (k230IsRunning && !k230Queue.isAwake()) k230StartTime = millis();
+  unsigned long k230Budget = K230D_MAX_UPTIME + (k230Queue.awaitingAcks() ? K230D_ACK_GRACE_MS : 0);
+  if (k230IsRunning && !snapshot.busy() && (millis() - k230StartTime > k230Budget)) {
     Serial.println("K230D Timeout: No face detected. Powering down.");
     K230DPowerOff();
   }
@@ -259,110 +352,227 @@ void handleTimeouts() {
 }
 
 void unlockDoor(String source) {
-  FCM_Notification("Lock Status", "Unlocked by " + source);
+  STALL_SCOPE("unlockDoor");
   // Fail-secure lock logic, Adjust logic for your lock type
   digitalWrite(LOCK_PIN, HIGH);  // Activate Solenoid (Open Lock)
+  energyLedger.set(EnergyConsumer::Solenoid, EnergyState::Active);
+  bleServer.solenoidFired();
   delay(3000);                   // Pulse duration
   digitalWrite(LOCK_PIN, LOW);   // Deactivate
+  energyLedger.set(EnergyConsumer::Solenoid, EnergyState::Off);
+  FCM_Notification("Lock Status", "Unlocked by " + source);  // After the pulse so TLS setup doesn't delay the door
+  heapAccounting.markCycle(HeapCycle::Unlock);
 }
 
 bool checkPin(const char *passCode) {
-  // Compare pass code from eeprom non volatile memory
-  String pin = prefs.getString("pin");
-  if (pin.equals("")) {
-    Serial.println("No pin code is set");
+  // Salted verifier cached by credentials, no NVS read per attempt
+  return credentials.verifyPin(passCode);
+}
+
+uint32_t restClient() { return (uint32_t)localServer.client().remoteIP(); }
+
+// Accepts a session token from the Authorization header, otherwise the PIN. A good PIN
+// mints a session for the caller, failures count towards that client's lockout.
+bool authorize(const char *pin, String &session) {
+  uint32_t client = restClient();
+  if (credentials.lockoutRemaining(client)) return false;
+
+  String header = localServer.header("Authorization");
+  if (header.startsWith("Bearer ") && credentials.verifySession(header.substring(7), client)) return true;
+
+  if (pin && checkPin(pin)) {
+    credentials.recordSuccess(client);
+    session = credentials.mintSession(client);
     return true;
   }
-  return pin.equals(passCode);
+  credentials.recordFailure(client);
+  return false;
 }
 
-void handleUART() {
-  if (Serial.available()) {
-    String response = Serial.readStringUntil('\n');
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, response);
-
-    if (!error) {
-      lastActivity = millis();
-      String status = doc["status"];
-
-      if (status == "match") {
-        unlockDoor(doc["name"]);
-        serverLog("{\"event\": \"unlock\", \"method\": \"face\", \"success\": \"true\", \"name\": \"" +
-                  doc["name"].as<String>() + "\"}");
-        K230DPowerOff();
-      } else if (status == "intruder") {
-        FCM_Notification("Intruder Alert!", "Unknown face detected at door.");
-        intruder += 1;
-        if (intruder <= 3) {
-          // Stay on for another 3s (reset timer) to capture more frames/upload
-          k230UpTime += millis() - k230StartTime;
-          k230StartTime = millis();
-        } else {
-          faceUnlockTimeout = millis();
-          K230DPowerOff();
-        }
-        serverLog("{\"event\": \"unlock\", \"method\": \"face\", \"success\": \"false\"}");
-      } else if (status == "awake") {
-        bootTime = (millis() - k230StartTime);
-        serverLog("{\"event\": \"boot\", \"bootTime\": \"" + String(float(bootTime) / 1000.0, 4) + "\"}");
+HTTPResponse unauthorized(const char *error = "Unauthorized Access") {
+  unsigned long remaining = credentials.lockoutRemaining(restClient());
+  if (remaining) {
+    return HTTPResponse{401, "application/json",
+                        "{\"status\":\"fail\", \"error\":\"Authorization Timeout\", \"timeRemaining\": " +
+                            String(remaining / 60000UL) + "}"};
+  }
+  return HTTPResponse{401, "application/json", "{\"status\":\"fail\", \"error\":\"" + String(error) + "\"}"};
+}
+
+String successBody(const String &session) {
+  if (session.isEmpty()) return "{\"status\":\"success\"}";
+  return "{\"status\":\"success\",\"session\":\"" + session + "\"}";
+}
+
+// Returns true once a full line or MessagePack frame is buffered; never blocks waiting for the rest
+bool readUARTLine(WireFormat &format) {
+  while (Serial.available()) {
+    uint8_t c = Serial.read();
+    if (uartFrameSkip) {
+      uartFrameSkip--;
+      continue;
+    }
+    if (uartFrameHeader) {
+      uartFrameLen = uartFrameLen << 8 | c;
+      if (--uartFrameHeader == 0 && uartFrameLen > UART_LINE_MAX) {
+        uartFrameSkip = uartFrameLen;
+        uartFrameLen = 0;
+      }
+      continue;
+    }
+    if (uartFrameLen) {  // Newline bytes are payload inside a frame
+      uartLine[uartLineLen++] = c;
+      if (uartLineLen < uartFrameLen) continue;
+      uartFrameLen = 0;
+      format = WireFormat::MsgPack;
+      return true;
+    }
+    if (uartLineLen == 0 && c == WIRE_FRAME_MARKER) {
+      uartFrameHeader = WIRE_FRAME_HEADER - 1;
+      uartFrameLen = 0;
+      continue;
+    }
+    if (c == '\n') {
+      if (uartLineOverflow || uartLineLen == 0) {
+        uartLineLen = 0;
+        uartLineOverflow = false;
+        return false;
       }
+      uartLine[uartLineLen] = '\0';
+      format = WireFormat::Json;
+      return true;
     }
+    if (uartLineLen < UART_LINE_MAX - 1) uartLine[uartLineLen++] = c;
+    else uartLineOverflow = true;  // Drop the rest of an oversized line
   }
+  return false;
+}
+
+void faceMatched(const String &name) {
+  unlockDoor(name);
+  serverLog("{\"event\": \"unlock\", \"method\": \"face\", \"success\": \"true\", \"name\": \"" + name + "\"}");
+  K230DPowerOff();
 }
 
-uint8_t getBatteryLevel() {
-  int raw = analogRead(BATTERY_PIN);
-  float sumVolt = 0;
-  for (uint8_t i = 0; i < 10; i++) {
-    sumVolt += (raw / 4095.0) * 3.3 * (12.0 / 3.3);  // Adjust for your voltage divider
+void intruderDetected() {
+  if (faceUnlockTimeout) return;  // Locked out, the K230D only stays up for the snapshot already asked for
+  snapshot.request();
+  k230Queue.enqueue("{\"cmd\":\"snapshot\"}");  // K230D is already up
+  FCM_Notification("Intruder Alert!", "Unknown face detected at door.");
+  intruder += 1;
+  if (intruder <= 3) {
+    // Stay on for another 3s (reset timer) to capture more frames/upload
+    k230UpTime += millis() - k230StartTime;
+    k230StartTime = millis();
+  } else {
+    // One more budget for the snapshot to be announced, handleTimeouts() powers down once it is in
+    k230UpTime += millis() - k230StartTime;
+    k230StartTime = millis();
+    faceUnlockTimeout = millis();
+  }
+  serverLog("{\"event\": \"unlock\", \"method\": \"face\", \"success\": \"false\"}");
+}
+
+// Gallery mode: the K230D only sends an embedding, the match runs on the lock
+void handleEmbedding(const char *encoded) {
+  alignas(16) int8_t embedding[FACE_EMBEDDING_DIM];
+  if (!decodeEmbedding(encoded, embedding)) {
+    Serial.println("Malformed face embedding from K230D.");
+    return;
+  }
+
+  float score;
+  int index = faceGallery.match(embedding, score);
+  if (index >= 0) faceMatched(faceGallery.name(index));
+  else intruderDetected();
+}
+
+void handleUART() {
+  STALL_SCOPE("handleUART");
+  HEAP_SCOPE(K230D);
+  powerManager.handled(WakeSource::UART);
+  WireFormat format;
+  if (readUARTLine(format)) {
+    handleK230DMessage(uartLine, uartLineLen, format);
+    uartLineLen = 0;
   }
-  float voltage = sumVolt / 10;
-  int scaled = (int)(voltage * 100);
-  switch (scaled) {
-    case 1260 ... 1300:  // 12.6+ volts
-      return 100;
-    case 1250: return 90;
-    case 1242: return 80;
-    case 1232: return 70;
-    case 1220: return 60;
-    case 1206: return 50;
-    case 1190: return 40;
-    case 1175: return 30;
-    case 1158: return 20;
-    case 1131: return 10;
-    case 1050: return 0;
-    default: return 0;
+}
+
+void handleK230DMessage(const char *line, size_t length, WireFormat format) {
+  PooledJsonDocument doc;
+  if (wireDecode(doc, (const uint8_t *)line, length, format, WireMessage::K230DStatus)) return;
+
+  lastActivity = millis();
+  const char *status = doc["status"] | "";
+
+  if (strcmp(status, "match") == 0) {
+    faceMatched(doc["name"].as<String>());
+  } else if (strcmp(status, "intruder") == 0) {
+    intruderDetected();
+  } else if (strcmp(status, "embedding") == 0) {
+    handleEmbedding(doc["emb"]);
+  } else if (strcmp(status, "snapshot") == 0) {
+    snapshot.expect(doc["len"] | 0, doc["crc"] | 0u, doc["crc"].is<uint32_t>());  // JPEG follows on the data link
+  } else if (strcmp(status, "ack") == 0) {
+    k230Queue.ack(doc["id"] | 0, doc["ok"] | true);
+  } else if (strcmp(status, "awake") == 0) {
+    bootTime = (millis() - k230PoweredAt);
+    bool msgpack = doc["wire"] == "msgpack" || format == WireFormat::MsgPack;
+    k230Queue.awake(msgpack ? WireFormat::MsgPack : WireFormat::Json, doc["acks"] | false);
+    serverLog("{\"event\": \"boot\", \"bootTime\": \"" + String(float(bootTime) / 1000.0, 4) + "\"}");
   }
 }
 
+// Cached state of charge, refreshed by monitorBattery()
+uint8_t getBatteryLevel() { return battery.level(); }
+
+// Consumer states read off the main loop; the solenoid is switched in unlockDoor() and the
+// commissioning server in initialCommisioning(), which both block loop()
+void trackEnergy() {
+  EnergyState wifi = WiFi.status() == WL_CONNECTED ? (mqttActive ? EnergyState::Active : EnergyState::Idle)
+                     : (WiFi.getMode() & WIFI_MODE_AP) ? EnergyState::Active
+                                                       : EnergyState::Off;
+  energyLedger.set(EnergyConsumer::WiFi, wifi);
+  energyLedger.set(EnergyConsumer::K230D, k230IsRunning ? EnergyState::Active : EnergyState::Off);
+  energyLedger.set(EnergyConsumer::Ble, bleServer.isConnected()      ? EnergyState::Active
+                                        : bleServer.proximityActive() ? EnergyState::Idle
+                                                                      : EnergyState::Off);
+  energyLedger.update(powerManager.idleUs(), powerManager.mode() == PowerMode::LightSleep, getBatteryLevel());
+}
+
 void monitorBattery() {
-  if (millis() - lastBatCheck > 15 * 60000ULL) {  // Check every 15 minutes
-    uint8_t batLevel = getBatteryLevel();
-    switch (batLevel) {
-      case 20:
-        FCM_Notification("Low Battery", "{\"battery\": 20%}");
-        FCM_Notification("Low Battery", "{\"warning\": \"Battery Low. Charge battery soon.\"}");
-        break;
-      case 10:
-        FCM_Notification("Low Battery", "{\"battery\": 10%}");
-        FCM_Notification("Low Battery", "{\"warning\": \"Battery Low. Charge battery.\"}");
-        break;
-      case 0: FCM_Notification("Low Battery", "{\"warning\": \"Battery depleted. Recharge Now!\"}"); break;
-      default: FCM_Notification("Lock Battery", "{\"battery\": " + String(batLevel) + "%}");
-    }
-    lastBatCheck = millis();
+  STALL_SCOPE("monitorBattery");
+  if (!battery.update()) return;
+
+  // Notify only when a threshold is crossed, BatteryAlarm applies the hysteresis
+  switch (battery.takeAlert()) {
+    case 20:
+      FCM_Notification("Low Battery", "{\"battery\": 20%}");
+      FCM_Notification("Low Battery", "{\"warning\": \"Battery Low. Charge battery soon.\"}");
+      break;
+    case 10:
+      FCM_Notification("Low Battery", "{\"battery\": 10%}");
+      FCM_Notification("Low Battery", "{\"warning\": \"Battery Low. Charge battery.\"}");
+      break;
+    case 0: FCM_Notification("Low Battery", "{\"warning\": \"Battery depleted. Recharge Now!\"}"); break;
+    default: break;
   }
 }
 
 // --- NOTIFICATIONS & CONNECTIVITY ---
 
+String fcmPayload(const String &title, const String &body) {
+  return "{\"to\":\"/topics/" + USER_ID + "/all\", \"priority\":\"high\", \"notification\":{\"title\":\"" + title +
+         "\", \"body\":\"" + body + "\"}}";
+}
+
 void FCM_Notification(String title, String body) {
+  STALL_SCOPE("FCM_Notification");
+  HEAP_SCOPE(Notify);
   WiFiClientSecure client;
   client.setInsecure();
   if (client.connect(fcm_server, 443)) {
-    String payload = "{\"to\":\"/topics/" + USER_ID + "/all\", \"priority\":\"high\", \"notification\":{\"title\":\"" +
-                     title + "\", \"body\":\"" + body + "\"}}";
+    String payload = fcmPayload(title, body);
     client.println("POST /fcm/send HTTP/1.1");
     client.println("Authorization: key=" + String(fcm_key));
     client.println("Content-Type: application/json");
@@ -411,6 +621,7 @@ void disableBLE() {
 }
 
 void connectToWifi(const String &ssid, const String &password) {
+  STALL_SCOPE("connectToWifi");
   if (ssid.isEmpty()) {
     Serial.println("WiFi SSID is empty. Cannot connect to WiFi.");
     return;
@@ -470,6 +681,7 @@ void initialCommisioning() {
 
   // If credentials not in NVS, start BLE and wait for commissioning
   bleServer.begin("JUPY Lock Pro");
+  energyLedger.set(EnergyConsumer::Ble, EnergyState::Active);
   Serial.println("Waiting for BLE commissioning payload to complete...");
 
   unsigned long commissionStart = millis();
@@ -526,6 +738,7 @@ void initialCommisioning() {
   // close ble server
   bleServer.end();
   disableBLE();  // Disable BLE after commissioning
+  energyLedger.set(EnergyConsumer::Ble, EnergyState::Off);
 }
 
 void endMQTTSession() {
@@ -535,42 +748,119 @@ void endMQTTSession() {
 }
 
 void reconnectMQTT() {
+  STALL_SCOPE("reconnectMQTT");
+  HEAP_SCOPE(MQTT);
   if (mqttClient.connect("JUPY_SmartLock")) {
     mqttClient.subscribe(("lock/commands/" + USER_ID).c_str(), 0);
+    serverLog("{\"event\":\"energy\",\"battery\":" + String(getBatteryLevel()) +
+              ",\"projection\":" + energyLedger.projectionJson(getBatteryLevel()) + "}");
+  }
+}
+
+// Runs a typed command from either path. A command ID already served on the other path is acked
+// again without running twice, so the app can race LAN and cloud and take the first ack.
+bool runCommand(JsonVariantConst doc, CommandPath path, String &ack) {
+  STALL_SCOPE("runCommand");
+  int64_t receivedUs = esp_timer_get_time();
+  Command command;
+  if (!parseCommand(doc, command)) return false;
+  if (commandLog.duplicate(command, path, receivedUs, ack)) return true;
+
+  bool ok = true;
+  switch (command.type) {
+    case CommandType::Unlock:
+      // The solenoid pulse and notification take seconds, so it runs from loop() after the ack has gone out
+      deferredUnlock = command.name ? command.name : (path == CommandPath::Local ? "Local App" : "Remote App");
+      break;
+    case CommandType::StartCall:
+      wakeK230D("{\"cmd\":\"start_call\",\"room_id\":\"" + String(command.roomId) + "\"}");
+      break;
+    case CommandType::EndCall:
+      endMQTTSession();
+      break;
+    case CommandType::GetStalls:
+      ok = mqttPublish("lock/diag/" + USER_ID, stallMonitor.recordsJson());
+      break;
+    case CommandType::Ota:
+      // The broker is public and MQTT carries no PIN or session, so firmware only comes over the LAN
+      if (path == CommandPath::Cloud) {
+        ok = false;
+        break;
+      }
+      ok = ota.start(command.url, command.size, command.sha256, command.signature, command.version);
+      serverLog(ota.statusJson());
+      break;
+    default:
+      return false;
   }
+  ack = commandLog.record(command, path, ok, receivedUs);
+  return true;
+}
+
+void runDeferredUnlock() {
+  if (deferredUnlock.isEmpty()) return;
+  String source = deferredUnlock;
+  deferredUnlock = "";
+  unlockDoor(source);
 }
 
 void mqttCallback(char *topic, byte *payload, unsigned int length) {
+  STALL_SCOPE("mqttCallback");
+  HEAP_SCOPE(MQTT);
   lastActivity = millis();
-  JsonDocument doc;
-  deserializeJson(doc, payload);
+  WireFormat format = wireDetect(payload, length);
+  PooledJsonDocument doc;
+  if (wireDecode(doc, payload, length, format, WireMessage::Command)) return;
+
+  String ack;
+  // Acked in the command's own encoding, legacy commands without an ID get no ack
+  if (runCommand(doc, CommandPath::Cloud, ack) && doc["id"]) mqttPublish("lock/acks/" + USER_ID, ack, format);
+}
+
+// Push the finished snapshot to cloud storage and report how long it took to get there
+void relaySnapshot() {
+  STALL_SCOPE("relaySnapshot");
+  HEAP_SCOPE(K230D);
+  String url = "https://" + String(projectId) + ".supabase.co/storage/v1/object/snapshots/" + String(LOCK_ID) +
+               "/latest.jpg";
+  if (!snapshot.upload(url, prefs.getString("token"))) Serial.println("Snapshot upload failed.");
+  serverLog(snapshot.statsJson());
+}
 
-  if (doc["cmd"] == "unlock") unlockDoor("Remote App");
-  else if (doc["cmd"] == "start_call")
-    wakeK230D("{\"cmd\":\"start_call\",\"room_id\":\"" + doc["room_id"].as<String>() + "\"}");
-  else if (doc["cmd"] == "end_call") endMQTTSession();
+// Logs and diagnostics stay JSON, only acks follow the encoding of the command they answer
+bool mqttPublish(const String &topic, const String &json, WireFormat format) {
+  String payload = wireTranscode(json, format);
+  return mqttClient.publish(topic.c_str(), (const uint8_t *)payload.c_str(), payload.length());
 }
 
 void serverLog(String log) {
+  HEAP_SCOPE(MQTT);
   // TODO: User database logging instead via post request instead of MQTT
   if (mqttActive) {
-    mqttClient.publish(("lock/logs/" + USER_ID).c_str(), log.c_str());
+    mqttPublish("lock/logs/" + USER_ID, log);
   }
 }
 
 void handleRequest(String route, HTTPMethod method, std::function<HTTPResponse(const String &)> callback) {
   localServer.on(route, method, [route, callback]() {
+    STALL_SCOPE(route.c_str());
+    HEAP_SCOPE(REST);
     String body = "";
     if (localServer.hasArg("plain")) {
       body = localServer.arg("plain");  // get POST body
-      Serial.println("Received body: " + body);
+      Serial.println("Received body: " + String(body.length()) + " bytes");
     } else {
       Serial.print("At route " + route);
       Serial.println(" No body received");
     }
     HTTPResponse resp = callback(body);
     if (resp.code == 0 && resp.contentType == "") resp = HTTPResponse{200, "text/plain", String("")};
-    localServer.send(resp.code, resp.contentType, resp.body.c_str());
+    WireFormat format = wireAccepts(localServer.header("Accept").c_str());
+    if (format == WireFormat::MsgPack && strcmp(resp.contentType, WIRE_JSON_MIME) == 0) {
+      resp.body = wireTranscode(resp.body, format);
+      resp.contentType = wireContentType(format);
+    }
+    localServer.send(resp.code, resp.contentType, resp.body);
   });
 }
 
@@ -582,14 +872,11 @@ bool validateSettings(const char *setting) {
   return false;
 }
 
-HTTPResponse updateSettings(String body) {
-  if (authFail == 3) {
-    return HTTPResponse{401, "application/json",
-                        ("{\"status\":\"fail\", \"error\":\"Authorization Timeout\", \"timeRemaining\": " +
-                         String((AUTH_DISABLE_TIME - (millis() - authTimeout)) / 60000UL) + "}")};
-  }
-  JsonDocument data;
-  DeserializationError error = deserializeJson(data, body);
+HTTPResponse updateSettings(const String &body) {
+  if (credentials.lockoutRemaining(restClient())) return unauthorized();
+  PooledJsonDocument data;
+  DeserializationError error =
+      wireDecode(data, (const uint8_t *)body.c_str(), body.length(), WireFormat::Json, WireMessage::Settings);
   if (error) {
     return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try Again.\"}"};
   }
@@ -605,12 +892,11 @@ HTTPResponse updateSettings(String body) {
   notify_motion = settings["notify_motion"];                // true
   share_analytics = settings["share_analytics"];            // true
 
-  if (!checkPin(data["pin"].as<const char *>()) || !name.equals(OWNER_NAME)) {
-    authFail += 1;
-    if (authFail == 3) {
-      authTimeout = millis();
-    }
-    return HTTPResponse{401, "application/json", "{\"status\":\"fail\", \"error\":\"Unauthorized Access\"}"};
+  String session;
+  if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+  if (!name.equals(OWNER_NAME)) {
+    credentials.recordFailure(restClient());
+    return unauthorized();
   }
   if (name && settings) {
     for (JsonPair kvp : settings) {
@@ -643,12 +929,29 @@ HTTPResponse updateSettings(String body) {
         serverLog(json.c_str());
       }
     }
-    return HTTPResponse{200, "application/json", "{\"status\":\"success\"}"};
+    return HTTPResponse{200, "application/json", successBody(session)};
   } else {
     return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Bad request.\"}"};
   }
 }
 
+// DNS-SD record so the app finds the lock on the LAN after DHCP hands it a new address
+void startMDNS() {
+  String host = "jupy-lock-" + String(SIMPLE_ID);
+  if (!MDNS.begin(host.c_str())) {
+    Serial.println("[mDNS] Responder failed to start");
+    return;
+  }
+  MDNS.addService("jupylock", "tcp", 80);
+  MDNS.addServiceTxt("jupylock", "tcp", "lock_id", LOCK_ID);
+  MDNS.addServiceTxt("jupylock", "tcp", "fw", FIRMWARE_VERSION);
+  MDNS.addServiceTxt("jupylock", "tcp", "model", LOCK_MODEL);
+  MDNS.addServiceTxt("jupylock", "tcp", "api", "/command");
+  MDNS.addServiceTxt("jupylock", "tcp", "caps", commandCapabilities());
+  MDNS.addService("http", "tcp", 80);
+  Serial.println("[mDNS] Advertising " + host + ".local");
+}
+
 void setupREST() {
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi not connected. Attempting to reconnect...");
@@ -667,33 +970,196 @@ void setupREST() {
     }
   }
 
-  handleRequest("/unlock", HTTP_POST, [](String body) {
-    JsonDocument data;
-    DeserializationError error = deserializeJson(data, body);
+  startMDNS();
+
+  handleRequest("/command", HTTP_POST, [](const String &body) {
+    PooledJsonDocument data;
+    if (wireDecode(data, (const uint8_t *)body.c_str(), body.length(), WireFormat::Json, WireMessage::Command)) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    String ack;
+    if (!runCommand(data, CommandPath::Local, ack)) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Unknown command\"}"};
+    }
+    return HTTPResponse{200, "application/json", ack};
+  });
+  handleRequest("/diagnostics/k230d", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", k230Queue.statsJson()}; });
+  handleRequest("/diagnostics/energy", HTTP_GET, [](const String &body) {
+    return HTTPResponse{200, "application/json", energyLedger.statsJson(getBatteryLevel())};
+  });
+  handleRequest("/diagnostics/commands", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", commandLog.statsJson()}; });
+  handleRequest("/unlock", HTTP_POST, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin", "name"});
+    PooledJsonDocument data;
+    DeserializationError error =
+        deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter));
     if (error) {
       return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
     }
-    if (checkPin(data["pin"].as<const char *>())) {
+    String session;
+    if (authorize(data["pin"].as<const char *>(), session)) {
       unlockDoor(data["name"]);
-      return HTTPResponse{200, "application/json", "{\"status\":\"success\"}"};
+      return HTTPResponse{200, "application/json", successBody(session)};
     } else {
-      return HTTPResponse{401, "application/json",
-                          "{\"status\":\"fail\", \"error\":\"Wrong pin stored, pin may have been updated\" }"};
+      return unauthorized("Wrong pin stored, pin may have been updated");
     }
   });
   handleRequest("/health", HTTP_GET,
-                [](String body) { return HTTPResponse{200, "application/json", "{\"status\":\"I am healthy\"}"}; });
+                [](const String &body) { return HTTPResponse{200, "application/json", "{\"status\":\"I am healthy\"}"}; });
   handleRequest("/update-settings", HTTP_PATCH, &updateSettings);
-  handleRequest("/status", HTTP_GET, [](String body) {
+  // The door camera image needs the same session or PIN as /command, passed as ?pin= on a GET
+  localServer.on("/snapshot/latest", HTTP_GET, []() {
+    String session;
+    if (!authorize(localServer.hasArg("pin") ? localServer.arg("pin").c_str() : nullptr, session)) {
+      HTTPResponse resp = unauthorized();
+      localServer.send(resp.code, resp.contentType, resp.body);
+      return;
+    }
+    snapshot.serve(localServer);
+  });
+  handleRequest("/snapshot/stats", HTTP_GET, [](const String &body) {
+    String session;
+    if (!authorize(localServer.hasArg("pin") ? localServer.arg("pin").c_str() : nullptr, session)) {
+      return unauthorized();
+    }
+    return HTTPResponse{200, "application/json", snapshot.statsJson()};
+  });
+  handleRequest("/ota", HTTP_POST, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin", "url", "size", "sha256", "signature", "version"});
+    PooledJsonDocument data;
+    if (deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter))) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    if (!ota.start(data["url"].as<String>(), data["size"], data["sha256"].as<String>(),
+                   data["signature"].as<String>(), data["version"].as<String>())) {
+      return HTTPResponse{400, "application/json", ota.statusJson()};
+    }
+    return HTTPResponse{202, "application/json", ota.statusJson()};
+  });
+  handleRequest("/ota/status", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", ota.statusJson()}; });
+  // Raw image upload, resumable with ?offset= set to the verified offset from /ota/status
+  localServer.on(
+      "/ota/upload", HTTP_POST, []() { localServer.send(otaUploadOk ? 200 : 400, "application/json", ota.statusJson()); },
+      []() {
+        HTTPUpload &upload = localServer.upload();
+        if (upload.status == UPLOAD_FILE_START) {
+          String session;
+          otaUploadOk = authorize(localServer.hasArg("pin") ? localServer.arg("pin").c_str() : nullptr, session) &&
+                        ota.beginUpload(localServer.arg("size").toInt(), localServer.arg("sha256"),
+                                        localServer.arg("signature"), localServer.arg("version"),
+                                        localServer.arg("offset").toInt());
+        } else if (upload.status == UPLOAD_FILE_WRITE && otaUploadOk) {
+          stallMonitor.feed();  // The whole upload runs inside one handleClient() call
+          otaUploadOk = ota.writeUpload(upload.buf, upload.currentSize);
+        } else if (upload.status == UPLOAD_FILE_END || upload.status == UPLOAD_FILE_ABORTED) {
+          ota.endUpload();
+        }
+      });
+  handleRequest("/diagnostics/stalls", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", stallMonitor.recordsJson()}; });
+  handleRequest("/diagnostics/power", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", powerManager.statsJson()}; });
+  handleRequest("/diagnostics/heap", HTTP_GET, [](const String &body) {
+    return HTTPResponse{200, "application/json", String(heapAccounting.reportJson().c_str())};
+  });
+  handleRequest("/diagnostics/auth", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", credentials.timingJson()}; });
+  handleRequest("/gallery", HTTP_GET, [](const String &body) {
+    return HTTPResponse{200, "application/json",
+                        "{\"enabled\":" + String(faceGallery.enabled() ? "true" : "false") +
+                            ",\"count\":" + String(faceGallery.size()) +
+                            ",\"capacity\":" + String(faceGallery.capacity()) + "}"};
+  });
+  handleRequest("/gallery/enroll", HTTP_POST, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin", "name", "emb"});
+    PooledJsonDocument data;
+    if (deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter))) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    const char *name = data["name"] | "";
+    if (!*name) return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Missing name\"}"};
+    alignas(16) int8_t embedding[FACE_EMBEDDING_DIM];
+    if (!decodeEmbedding(data["emb"], embedding)) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Invalid embedding\"}"};
+    }
+    if (!faceGallery.enroll(name, embedding)) {
+      return HTTPResponse{507, "application/json", "{\"status\":\"fail\", \"error\":\"Gallery full\"}"};
+    }
+    return HTTPResponse{200, "application/json", successBody(session)};
+  });
+  handleRequest("/ble/enroll", HTTP_POST, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin"});
+    PooledJsonDocument data;
+    if (deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter))) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    uint8_t key[PROXIMITY_KEY_LEN];
+    int slot = bleServer.enrollPhone(key);
+    if (slot < 0) {
+      return HTTPResponse{507, "application/json", "{\"status\":\"fail\", \"error\":\"All phone slots in use\"}"};
+    }
+    char keyHex[PROXIMITY_KEY_LEN * 2 + 1];
+    for (size_t i = 0; i < PROXIMITY_KEY_LEN; i++) snprintf(keyHex + i * 2, 3, "%02x", key[i]);
+    bleServer.beginProximity("JUPY Lock Pro");
+    return HTTPResponse{200, "application/json",
+                        "{\"status\":\"success\",\"slot\":" + String(slot) + ",\"key\":\"" + String(keyHex) + "\"}"};
+  });
+  handleRequest("/ble/enroll", HTTP_DELETE, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin", "slot"});
+    PooledJsonDocument data;
+    if (deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter))) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    if (!bleServer.removePhone(data["slot"] | PROXIMITY_PHONES)) {
+      return HTTPResponse{404, "application/json", "{\"status\":\"fail\", \"error\":\"Slot not enrolled\"}"};
+    }
+    if (!bleServer.proximityEnrolled() && bleServer.proximityActive()) bleServer.end();
+    return HTTPResponse{200, "application/json", successBody(session)};
+  });
+  handleRequest("/diagnostics/ble", HTTP_GET,
+                [](const String &body) { return HTTPResponse{200, "application/json", bleServer.proximityStatsJson()}; });
+  handleRequest("/gallery", HTTP_DELETE, [](const String &body) {
+    static const JsonDocument filter = makeJsonFilter({"pin", "name"});
+    PooledJsonDocument data;
+    if (deserializeJson(data, body.c_str(), body.length(), DeserializationOption::Filter(filter))) {
+      return HTTPResponse{400, "application/json", "{\"status\":\"fail\", \"error\":\"Parsing failed. Try again\" }"};
+    }
+    String session;
+    if (!authorize(data["pin"].as<const char *>(), session)) return unauthorized();
+    if (!faceGallery.remove(data["name"] | "")) {
+      return HTTPResponse{404, "application/json", "{\"status\":\"fail\", \"error\":\"Name not enrolled\"}"};
+    }
+    return HTTPResponse{200, "application/json", successBody(session)};
+  });
+  handleRequest("/status", HTTP_GET, [](const String &body) {
     String status = "{";
     status += "\"lock_name\":\"" + LOCK_NAME + "\",";
     status += "\"owner\":\"" + OWNER_NAME + "\",";
     status += "\"wifi_ssid\":\"" + prefs.getString("wifi_ssid") + "\",";
     status += "\"battery\":\"" + String(getBatteryLevel()) + "\",";
+    status += "\"battery_mv\":" + String(battery.millivolts()) + ",";
+    EnergyProjection energy = energyLedger.projection(getBatteryLevel());
+    status += "\"days_to_empty\":" + String(energy.daysToEmpty, 1) + ",";
+    status += "\"days_to_empty_trend\":" + String(energy.trendDaysToEmpty, 1);
     status += "}";
     return HTTPResponse{200, "application/json", status};
   });
   
+  const char *headers[] = {"Authorization", "Accept"};
+  localServer.collectHeaders(headers, 2);
   localServer.begin();
   Serial.print("[Server] REST Server started on: ");
   Serial.println(WiFi.localIP());
@@ -701,6 +1167,7 @@ void setupREST() {
 
 // --- DISPLAY & TOUCH ---
 void drawKeypad() {
+  HEAP_SCOPE(UI);
   tft.fillScreen(TFT_BLACK);
   tft.setTextSize(2);
   String keys[4][3] = {
@@ -716,6 +1183,10 @@ void drawKeypad() {
 }
 
 void handleTouch() {
+  STALL_SCOPE("handleTouch");
+  HEAP_SCOPE(UI);
+  powerManager.handled(WakeSource::Touch);
+  if (digitalRead(T_IRQ) == HIGH) return;  // No touch, skip the SPI read
   uint16_t x, y;
 
   if (tft.getTouch(&x, &y)) {
@@ -726,12 +1197,19 @@ void handleTouch() {
       passcodeBuffer = "";
     } else if (row == 3 && col == 2) {  // B - Bell
       if (passcodeBuffer.length() == 0) {
+        snapshot.request();
+        wakeK230D("{\"cmd\":\"snapshot\"}");
         FCM_Notification("Doorbell", "Someone is at " + OWNER_NAME + "'s " + LOCK_NAME + "!");
         mqttActive = true;  // Enable MQTT to listen for the call initiation
       } else {
-        if (checkPin(passcodeBuffer.c_str())) {
+        if (credentials.lockoutRemaining(CRED_KEYPAD_CLIENT)) {
+          Serial.println("Keypad locked out");
+        } else if (checkPin(passcodeBuffer.c_str())) {
+          credentials.recordSuccess(CRED_KEYPAD_CLIENT);
           unlockDoor("Passcode");
           if (faceUnlockTimeout) pinManuallyEntered = true;
+        } else {
+          credentials.recordFailure(CRED_KEYPAD_CLIENT);
         }
         passcodeBuffer = "";
       }
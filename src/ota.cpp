@@ -0,0 +1,455 @@
+#include "ota.h"
+#include <WiFi.h>
+#include <mbedtls/ecdsa.h>
+
+#define OTA_RECONNECT_DELAY 2000UL
+
+static size_t fromHex(const char *hex, uint8_t *out, size_t capacity) {
+  size_t length = strlen(hex);
+  if (!length || length % 2 || length / 2 > capacity) return 0;
+  for (size_t i = 0; i < length / 2; i++) {
+    char byte[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+    char *end;
+    out[i] = strtoul(byte, &end, 16);
+    if (*end) return 0;
+  }
+  return length / 2;
+}
+
+// Numeric dot-separated parts after an optional "v", so "v1.10" is newer than "v1.9"
+static int compareVersions(const char *a, const char *b) {
+  if (*a == 'v' || *a == 'V') a++;
+  if (*b == 'v' || *b == 'V') b++;
+  while (*a || *b) {
+    char *end;
+    unsigned long partA = strtoul(a, &end, 10);
+    a = *end == '.' ? end + 1 : end + strlen(end);
+    unsigned long partB = strtoul(b, &end, 10);
+    b = *end == '.' ? end + 1 : end + strlen(end);
+    if (partA != partB) return partA < partB ? -1 : 1;
+  }
+  return 0;
+}
+
+// ECDSA P-256 over SHA-256(image digest + version), against the key built into this firmware
+static bool verifySignature(const uint8_t *imageDigest, const String &version, const String &signatureHex) {
+  uint8_t key[65];
+  uint8_t sig[OTA_SIGNATURE_MAX];
+  size_t sigLength = fromHex(signatureHex.c_str(), sig, sizeof(sig));
+  if (fromHex(OTA_SIGNING_KEY, key, sizeof(key)) != sizeof(key) || !sigLength) return false;
+
+  uint8_t digest[32];
+  mbedtls_sha256_context hash;
+  mbedtls_sha256_init(&hash);
+  mbedtls_sha256_starts_ret(&hash, 0);
+  mbedtls_sha256_update_ret(&hash, imageDigest, 32);
+  mbedtls_sha256_update_ret(&hash, (const uint8_t *)version.c_str(), version.length());
+  mbedtls_sha256_finish_ret(&hash, digest);
+  mbedtls_sha256_free(&hash);
+
+  mbedtls_ecdsa_context ecdsa;
+  mbedtls_ecdsa_init(&ecdsa);
+  bool ok = mbedtls_ecp_group_load(&ecdsa.grp, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+            mbedtls_ecp_point_read_binary(&ecdsa.grp, &ecdsa.Q, key, sizeof(key)) == 0 &&
+            mbedtls_ecp_check_pubkey(&ecdsa.grp, &ecdsa.Q) == 0 &&
+            mbedtls_ecdsa_read_signature(&ecdsa, digest, 32, sig, sigLength) == 0;
+  mbedtls_ecdsa_free(&ecdsa);
+  return ok;
+}
+
+OtaUpdater::OtaUpdater()
+    : target(nullptr), streaming(false), uploading(false), uploadJob(false), pendingHealth(false),
+      failurePending(false), rebootAt(0), retries(0), runningVersion(""), jobSize(0), offset(0), lastPersisted(0), buffered(0), lastByteAt(0), streamStart(0), heapAtStart(0),
+      heapLow(0), stats() {}
+
+// ==================== Health check & rollback ====================
+void OtaUpdater::checkHealthOnBoot(const char *firmwareVersion) {
+  runningVersion = firmwareVersion;
+  store.begin("ota", false);
+  lastResult = store.getString("result");
+  pendingHealth = store.getBool("pending");
+
+  if (pendingHealth) {
+    // Waking from deep sleep is not a new attempt, only real resets count
+    uint8_t boots = store.getUChar("boots");
+    if (esp_reset_reason() != ESP_RST_DEEPSLEEP) store.putUChar("boots", ++boots);
+    Serial.printf("[OTA] New image on trial, boot %u of %u\n", boots, OTA_MAX_BOOT_ATTEMPTS);
+    if (boots > OTA_MAX_BOOT_ATTEMPTS) rollback();
+  }
+
+  resume();
+}
+
+// The first good check confirms the image, it is only rolled back if none comes before the deadline
+void OtaUpdater::confirmHealthy(bool ok) {
+  if (!pendingHealth) return;
+
+  if (!ok) {
+    if (millis() < OTA_HEALTH_DEADLINE) return;
+    Serial.println("[OTA] New image did not get online before its deadline");
+    rollback();
+    return;
+  }
+  pendingHealth = false;
+  store.putBool("pending", false);
+  store.putUChar("boots", 0);
+  esp_ota_mark_app_valid_cancel_rollback();  // Also satisfies the bootloader when its rollback support is on
+  Serial.println("[OTA] New image confirmed healthy");
+}
+
+void OtaUpdater::rollback() {
+  pendingHealth = false;
+  store.putBool("pending", false);
+  store.putUChar("boots", 0);
+
+  const esp_partition_t *previous =
+      esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, store.getString("prev").c_str());
+  if (!previous || esp_ota_set_boot_partition(previous) != ESP_OK) {
+    Serial.println("[OTA] Rollback failed, no previous image");
+    return;
+  }
+  store.putString("result", "{\"status\":\"rolled_back\",\"version\":\"" + store.getString("version") + "\"}");
+  Serial.printf("[OTA] Rolling back to %s\n", previous->label);
+  esp_restart();
+}
+
+// ==================== Job state ====================
+bool OtaUpdater::start(const String &imageUrl, size_t size, const String &sha256, const String &imageSignature,
+                       const String &imageVersion) {
+  if (strlen(OTA_SIGNING_KEY) != 130) {
+    fail("No signing key built in, updates are disabled");
+    return false;
+  }
+  if (active() && expectedSha.equalsIgnoreCase(sha256) && signature.equalsIgnoreCase(imageSignature) &&
+      uploadJob == imageUrl.isEmpty()) {
+    return true;  // Same image, keep resuming
+  }
+  // The version is covered by the signature, so an older signed image can't pose as a newer one
+  if (compareVersions(imageVersion.c_str(), runningVersion) <= 0) {
+    fail("Version " + imageVersion + " is not newer than running " + runningVersion);
+    return false;
+  }
+
+  clearJob();
+  target = esp_ota_get_next_update_partition(NULL);
+  if (!target || size == 0 || size > target->size || sha256.length() != 64 || imageSignature.length() == 0 ||
+      imageSignature.length() > OTA_SIGNATURE_MAX * 2) {
+    fail("Invalid image, signature or no OTA partition");
+    return false;
+  }
+
+  url = imageUrl;
+  uploadJob = url.isEmpty();
+  expectedSha = sha256;
+  signature = imageSignature;
+  version = imageVersion;
+  jobSize = size;
+  offset = 0;
+  lastPersisted = 0;
+  buffered = 0;
+  retries = 0;
+  lastError = "";
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+
+  store.putString("url", url);
+  store.putBool("upload", uploadJob);
+  store.putString("sha", expectedSha);
+  store.putString("sig", signature);
+  store.putString("version", version);
+  store.putString("label", target->label);
+  store.putUInt("size", jobSize);
+  persist();
+  Serial.printf("[OTA] Update to %s started, %u bytes into %s\n", version.c_str(), (unsigned)jobSize, target->label);
+  return true;
+}
+
+// Reload an interrupted job and rebuild the hash from what is already in flash
+bool OtaUpdater::resume() {
+  size_t size = store.getUInt("size");
+  if (!size) return false;
+
+  target = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, store.getString("label").c_str());
+  if (!target || target == esp_ota_get_running_partition()) {
+    clearJob();
+    return false;
+  }
+
+  url = store.getString("url");
+  uploadJob = store.getBool("upload") || url.isEmpty();
+  expectedSha = store.getString("sha");
+  signature = store.getString("sig");
+  version = store.getString("version");
+  jobSize = size;
+  offset = store.getUInt("offset");
+  lastPersisted = offset;
+  buffered = 0;
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  for (size_t pos = 0; pos < offset; pos += OTA_CHUNK) {
+    size_t length = min((size_t)OTA_CHUNK, offset - pos);
+    if (esp_partition_read(target, pos, buffer, length) != ESP_OK) {
+      fail("Flash read failed while resuming");
+      return false;
+    }
+    mbedtls_sha256_update_ret(&sha, buffer, length);
+  }
+
+  stats.resumes++;
+  Serial.printf("[OTA] Resuming %s at %u/%u bytes\n", version.c_str(), (unsigned)offset, (unsigned)jobSize);
+  return true;
+}
+
+void OtaUpdater::persist() {
+  store.putUInt("offset", offset);
+  lastPersisted = offset;
+}
+
+void OtaUpdater::clearJob() {
+  closeStream();
+  if (jobSize) mbedtls_sha256_free(&sha);
+  jobSize = 0;
+  offset = 0;
+  buffered = 0;
+  uploading = false;
+  store.remove("size");
+  store.remove("offset");
+}
+
+void OtaUpdater::fail(const String &reason) {
+  lastError = reason;
+  Serial.println("[OTA] " + reason);
+}
+
+// Drops a job that can't succeed and keeps the reason as the last result
+void OtaUpdater::abandon(const String &reason) {
+  fail(reason);
+  lastResult = "{\"status\":\"failed\",\"version\":\"" + version + "\",\"error\":\"" + reason + "\"}";
+  store.putString("result", lastResult);
+  clearJob();
+  failurePending = true;
+}
+
+bool OtaUpdater::takeFailure() {
+  bool failed = failurePending;
+  failurePending = false;
+  return failed;
+}
+
+void OtaUpdater::trackHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < heapLow) heapLow = freeHeap;
+  if (heapAtStart - heapLow > stats.peakHeapUsed) stats.peakHeapUsed = heapAtStart - heapLow;
+}
+
+// ==================== Flash writes ====================
+// Erase, write and read back one sector, then fold it into the running hash
+bool OtaUpdater::writeChunk() {
+  if (esp_partition_erase_range(target, offset, OTA_CHUNK) != ESP_OK ||
+      esp_partition_write(target, offset, buffer, buffered) != ESP_OK) {
+    fail("Flash write failed");
+    return false;
+  }
+
+  uint8_t readBack[256];
+  for (size_t pos = 0; pos < buffered; pos += sizeof(readBack)) {
+    size_t length = min(sizeof(readBack), buffered - pos);
+    if (esp_partition_read(target, offset + pos, readBack, length) != ESP_OK ||
+        memcmp(readBack, buffer + pos, length) != 0) {
+      fail("Flash verify failed");
+      return false;
+    }
+  }
+
+  mbedtls_sha256_update_ret(&sha, buffer, buffered);
+  offset += buffered;
+  stats.streamedBytes += buffered;
+  buffered = 0;
+  trackHeap();
+
+  if (offset - lastPersisted >= OTA_PERSIST_EVERY) persist();
+  if (offset == jobSize) finish();
+  return true;
+}
+
+void OtaUpdater::finish() {
+  closeStream();
+  if (uploading) {
+    stats.activeMs += millis() - streamStart;
+    streamStart = millis();
+  }
+
+  uint8_t digest[32];
+  char hex[65];
+  mbedtls_sha256_finish_ret(&sha, digest);
+  for (int i = 0; i < 32; i++) sprintf(hex + i * 2, "%02x", digest[i]);
+
+  if (!expectedSha.equalsIgnoreCase(hex)) {
+    abandon("SHA-256 mismatch, image discarded");
+    return;
+  }
+  if (!verifySignature(digest, version, signature)) {
+    abandon("Signature check failed, image discarded");
+    return;
+  }
+
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  // Validates the image header and segments before switching
+  if (esp_ota_set_boot_partition(target) != ESP_OK) {
+    abandon("Image rejected by bootloader check");
+    return;
+  }
+
+  unsigned long kbps = stats.activeMs ? (stats.streamedBytes * 1000UL / 1024UL) / stats.activeMs : 0;
+  lastResult = "{\"status\":\"installed\",\"version\":\"" + version + "\",\"kb_per_s\":" + String(kbps) +
+               ",\"peak_heap_bytes\":" + String(stats.peakHeapUsed) + ",\"resumes\":" + String(stats.resumes) + "}";
+  store.putString("result", lastResult);
+  store.putString("prev", running->label);
+  store.putBool("pending", true);
+  store.putUChar("boots", 0);
+  clearJob();
+
+  Serial.println("[OTA] Update verified: " + lastResult);
+  rebootAt = millis() + 1000;  // Let the REST response or MQTT log go out first
+}
+
+// ==================== HTTP download ====================
+bool OtaUpdater::openStream() {
+  if (millis() - lastByteAt < OTA_RECONNECT_DELAY) return false;
+  lastByteAt = millis();
+
+  http.begin(url);
+  if (offset > 0) http.addHeader("Range", "bytes=" + String(offset) + "-");
+  int code = http.GET();
+
+  if (code == HTTP_CODE_OK && offset > 0) {
+    // Server ignored the Range header, start the image over
+    Serial.println("[OTA] Server does not support resume, restarting download");
+    mbedtls_sha256_free(&sha);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    offset = 0;
+    persist();
+  } else if (code != HTTP_CODE_OK && code != HTTP_CODE_PARTIAL_CONTENT) {
+    http.end();
+    // A client error won't go away by asking again
+    if (code >= 400 && code < 500) {
+      abandon("Download failed: HTTP " + String(code));
+    } else if (++retries >= OTA_MAX_RETRIES) {
+      abandon("Download failed " + String(retries) + " times, last HTTP " + String(code));
+    } else {
+      fail("Download failed: HTTP " + String(code));
+    }
+    return false;
+  }
+
+  retries = 0;
+  streaming = true;
+  streamStart = millis();
+  heapAtStart = ESP.getFreeHeap();
+  heapLow = heapAtStart;
+  return true;
+}
+
+void OtaUpdater::closeStream() {
+  if (!streaming) return;
+  stats.activeMs += millis() - streamStart;
+  http.end();
+  streaming = false;
+  buffered = 0;  // Anything short of a sector is fetched again on resume
+  if (jobSize) persist();
+}
+
+void OtaUpdater::poll() {
+  if (rebootAt && millis() > rebootAt) esp_restart();
+  if (!active() || uploading || uploadJob) return;  // An interrupted upload waits for ?offset=
+  if (WiFi.status() != WL_CONNECTED) {
+    closeStream();
+    return;
+  }
+  if (!streaming && !openStream()) return;
+
+  WiFiClient *stream = http.getStreamPtr();
+  for (int i = 0; i < OTA_CHUNKS_PER_POLL && active(); i++) {
+    size_t needed = min((size_t)OTA_CHUNK, jobSize - offset);
+    while (buffered < needed && stream->available()) {
+      buffered += stream->readBytes(buffer + buffered, min((size_t)stream->available(), needed - buffered));
+      lastByteAt = millis();
+    }
+    if (buffered < needed) break;
+    if (!writeChunk()) {
+      closeStream();
+      if (++retries >= OTA_MAX_RETRIES) abandon(lastError + ", gave up after " + String(retries) + " tries");
+      return;
+    }
+  }
+
+  if (streaming && (!stream->connected() || millis() - lastByteAt > OTA_STREAM_TIMEOUT)) {
+    Serial.printf("[OTA] Connection lost at %u bytes, will resume\n", (unsigned)offset);
+    closeStream();
+  }
+}
+
+// ==================== Local upload ====================
+bool OtaUpdater::beginUpload(size_t size, const String &sha256, const String &imageSignature,
+                             const String &imageVersion, size_t fromOffset) {
+  if (fromOffset > 0) {
+    // Client resumes where the lock says it has verified data
+    if (!active() || !expectedSha.equalsIgnoreCase(sha256) || fromOffset != offset) {
+      fail("Resume offset does not match verified offset");
+      return false;
+    }
+  } else if (!start("", size, sha256, imageSignature, imageVersion)) {
+    return false;
+  } else if (offset > 0) {
+    fail("Upload must resume from the verified offset");
+    return false;
+  }
+
+  closeStream();
+  uploading = true;
+  buffered = 0;
+  streamStart = millis();
+  heapAtStart = ESP.getFreeHeap();
+  heapLow = heapAtStart;
+  return true;
+}
+
+bool OtaUpdater::writeUpload(const uint8_t *data, size_t length) {
+  if (!uploading) return false;
+  while (length > 0 && active()) {
+    size_t needed = min((size_t)OTA_CHUNK, jobSize - offset);
+    size_t take = min(length, needed - buffered);
+    memcpy(buffer + buffered, data, take);
+    buffered += take;
+    data += take;
+    length -= take;
+    if (buffered == needed && !writeChunk()) return false;
+  }
+  return length == 0;
+}
+
+bool OtaUpdater::endUpload() {
+  if (uploading) stats.activeMs += millis() - streamStart;
+  uploading = false;
+  buffered = 0;
+  if (active()) persist();
+  return rebootAt != 0;  // finish() scheduled the reboot into the new image
+}
+
+String OtaUpdater::statusJson() const {
+  unsigned long kbps = stats.activeMs ? (stats.streamedBytes * 1000UL / 1024UL) / stats.activeMs : 0;
+  String json = "{\"running\":\"" + String(esp_ota_get_running_partition()->label) + "\"";
+  json += ",\"active\":" + String(active() ? "true" : "false");
+  if (active()) json += ",\"kind\":\"" + String(uploadJob ? "upload" : "download") + "\"";
+  json += ",\"version\":\"" + version + "\"";
+  json += ",\"offset\":" + String(offset) + ",\"size\":" + String(jobSize);
+  json += ",\"kb_per_s\":" + String(kbps) + ",\"peak_heap_bytes\":" + String(stats.peakHeapUsed);
+  json += ",\"resumes\":" + String(stats.resumes);
+  json += ",\"pending_health\":" + String(pendingHealth ? "true" : "false");
+  json += ",\"error\":\"" + lastError + "\"";
+  if (lastResult.length()) json += ",\"last\":" + lastResult;
+  json += "}";
+  return json;
+}
@@ -0,0 +1,103 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+
+#define OTA_CHUNK 4096               // One flash sector, erased and written as a unit
+#define OTA_PERSIST_EVERY 65536      // Verified offset is saved to NVS this often
+#define OTA_CHUNKS_PER_POLL 8        // Bounded work per loop() pass
+#define OTA_STREAM_TIMEOUT 15000UL   // No bytes for this long drops the connection, resumed later
+#define OTA_HEALTH_DEADLINE 300000UL // New image must get online within this after boot, or it is rolled back
+#define OTA_MAX_BOOT_ATTEMPTS 3      // Unhealthy boots before rolling back
+#define OTA_MAX_RETRIES 10           // Failed connects or flash writes in a row before the job is dropped
+#define OTA_SIGNATURE_MAX 72         // DER encoded ECDSA P-256 signature
+
+// Uncompressed P-256 public key as 130 hex characters ("04" + X + Y), set from build_flags.
+// Images must carry an ECDSA signature made with the matching private key over their SHA-256
+// followed by the version string, so the version can't be relabelled to pass the downgrade check.
+// Without a key every update is refused.
+#ifndef OTA_SIGNING_KEY
+#define OTA_SIGNING_KEY ""
+#endif
+
+struct OtaStats {
+  size_t streamedBytes;    // Written this boot, excludes bytes recovered from flash on resume
+  unsigned long activeMs;  // Time spent streaming, excludes gaps between resumes
+  uint32_t peakHeapUsed;
+  uint8_t resumes;
+};
+
+// Streams a firmware image into the inactive OTA partition in sector-sized chunks.
+// The verified offset survives Wi-Fi drops, deep sleep and resets, so a download
+// resumes with an HTTP Range request instead of starting over.
+class OtaUpdater {
+public:
+  OtaUpdater();
+
+  void checkHealthOnBoot(const char *firmwareVersion);  // Roll back if the new image keeps failing its health check
+  void confirmHealthy(bool ok);  // Called from loop(), confirms on the first ok before the deadline
+
+  bool start(const String &url, size_t size, const String &sha256, const String &signature, const String &version);
+  void poll();  // Advances an HTTP download, no-op when idle or waiting for an upload to resume
+  bool active() const { return jobSize > 0; }
+  bool takeFailure();  // True once after a job was dropped, so the failure can be published
+
+  // Local REST upload, fed from WebServer's HTTPUpload callbacks
+  bool beginUpload(size_t size, const String &sha256, const String &signature, const String &version,
+                   size_t offset);
+  bool writeUpload(const uint8_t *data, size_t length);
+  bool endUpload();
+
+  size_t verifiedOffset() const { return offset; }
+  String statusJson() const;
+
+private:
+  bool resume();
+  bool openStream();
+  bool writeChunk();
+  void finish();
+  void rollback();
+  void fail(const String &reason);
+  void abandon(const String &reason);
+  void persist();
+  void clearJob();
+  void closeStream();
+  void trackHeap();
+
+  Preferences store;
+  const esp_partition_t *target;
+  mbedtls_sha256_context sha;
+  HTTPClient http;
+  bool streaming;
+  bool uploading;
+  bool uploadJob;  // Fed by /ota/upload, after an interruption it waits for the client to resume
+  bool pendingHealth;
+  bool failurePending;
+  unsigned long rebootAt;
+  uint8_t retries;  // Failed connects or writes since the last good one
+  const char *runningVersion;
+
+  String url;
+  String expectedSha;
+  String signature;  // Hex DER, checked against OTA_SIGNING_KEY once the image is complete
+  String version;
+  size_t jobSize;
+  size_t offset;          // Bytes written and read back from flash
+  size_t lastPersisted;
+  uint8_t buffer[OTA_CHUNK];
+  size_t buffered;
+
+  unsigned long lastByteAt;
+  unsigned long streamStart;
+  uint32_t heapAtStart;
+  uint32_t heapLow;
+  OtaStats stats;
+  String lastError;
+  String lastResult;  // Summary of the last completed update, kept across the reboot
+};
+
+#endif  // OTA_H
@@ -0,0 +1,154 @@
+#include "power_manager.h"
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <hal/gpio_ll.h>
+
+static const char *SOURCE_NAMES[] = {"pir", "button", "touch", "uart", "ble", "timer"};
+
+struct WakePin {
+  uint8_t pin;
+  WakeSource source;
+  uint8_t activeLevel;
+  volatile uint8_t armedLevel;  // Level the pin is currently armed to interrupt (and wake) on
+};
+
+static WakePin wakePins[3];
+static portMUX_TYPE wakeMux = portMUX_INITIALIZER_UNLOCKED;
+
+PowerManager powerManager;
+
+PowerManager::PowerManager()
+    : pmMode(PowerMode::Polling), awake(false), loopTask(nullptr), noSleepLock(nullptr), pendingUs(), latency(),
+      beganUs(0), waitedUs(0) {}
+
+void PowerManager::begin(uint8_t pirPin, uint8_t buttonPin, uint8_t touchIrqPin) {
+  loopTask = xTaskGetCurrentTaskHandle();
+  beganUs = esp_timer_get_time();
+
+  // The prebuilt Arduino sdkconfig has neither CONFIG_PM_ENABLE nor tickless idle, so this build stays in
+  // polling mode. A custom sdkconfig with PM gets frequency scaling, and with tickless idle light sleep too
+  esp_pm_config_esp32s3_t config;
+  config.max_freq_mhz = POWER_MAX_FREQ_MHZ;
+  config.min_freq_mhz = POWER_MIN_FREQ_MHZ;
+  config.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&config);
+  if (err == ESP_ERR_NOT_SUPPORTED) {
+    config.light_sleep_enable = false;
+    err = esp_pm_configure(&config);
+  }
+  if (err == ESP_OK) {
+    pmMode = config.light_sleep_enable ? PowerMode::LightSleep : PowerMode::FrequencyScaling;
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &noSleepLock);
+  }
+  Serial.println("[Power] Mode: " + String(pmMode == PowerMode::LightSleep         ? "light sleep"
+                                           : pmMode == PowerMode::FrequencyScaling ? "frequency scaling"
+                                                                                   : "polling"));
+
+  // Level interrupts are what wake the chip from light sleep, the ISR flips the level so each edge fires once
+  wakePins[0] = WakePin{pirPin, WakeSource::PIR, 1, 0};
+  wakePins[1] = WakePin{buttonPin, WakeSource::Button, 1, 0};
+  wakePins[2] = WakePin{touchIrqPin, WakeSource::Touch, 0, 0};
+  gpio_install_isr_service(ESP_INTR_FLAG_IRAM);  // Already installed by attachInterrupt() is fine
+  for (WakePin &wake : wakePins) {
+    wake.armedLevel = !gpio_get_level((gpio_num_t)wake.pin);
+    gpio_isr_handler_add((gpio_num_t)wake.pin, gpioIsr, &wake);
+    gpio_wakeup_enable((gpio_num_t)wake.pin, wake.armedLevel ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable((gpio_num_t)wake.pin);
+  }
+  esp_sleep_enable_gpio_wakeup();
+
+  // K230D control link, it only talks while powered and stayAwake() covers that, so this is a backstop
+  uart_set_wakeup_threshold(UART_NUM_0, POWER_UART_WAKE_EDGES);
+  esp_sleep_enable_uart_wakeup(UART_NUM_0);
+  Serial.onReceive([]() { powerManager.signal(WakeSource::UART, false); });
+}
+
+void IRAM_ATTR PowerManager::gpioIsr(void *arg) {
+  WakePin *wake = (WakePin *)arg;
+  bool active = wake->armedLevel == wake->activeLevel;
+  wake->armedLevel = !wake->armedLevel;
+  gpio_ll_wakeup_enable(&GPIO, (gpio_num_t)wake->pin,
+                        wake->armedLevel ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+  if (active) powerManager.signal(wake->source, true);
+}
+
+void IRAM_ATTR PowerManager::signal(WakeSource source, bool fromIsr) {
+  int64_t now = esp_timer_get_time();
+  size_t s = (size_t)source;
+  if (fromIsr) {
+    portENTER_CRITICAL_ISR(&wakeMux);
+    if (!pendingUs[s]) pendingUs[s] = now;
+    portEXIT_CRITICAL_ISR(&wakeMux);
+
+    BaseType_t woken = pdFALSE;
+    if (loopTask) vTaskNotifyGiveFromISR(loopTask, &woken);
+    if (woken) portYIELD_FROM_ISR();
+  } else {
+    portENTER_CRITICAL(&wakeMux);
+    if (!pendingUs[s]) pendingUs[s] = now;
+    portEXIT_CRITICAL(&wakeMux);
+    if (loopTask) xTaskNotifyGive(loopTask);
+  }
+}
+
+void PowerManager::stayAwake(bool keep) {
+  if (keep == awake) return;
+  awake = keep;
+  if (!noSleepLock) return;
+  if (keep) esp_pm_lock_acquire(noSleepLock);
+  else esp_pm_lock_release(noSleepLock);
+}
+
+void PowerManager::waitForEvent() {
+  if (!loopTask) return;
+
+  // Busy links still yield a tick so lower-priority tasks run
+  uint32_t timeoutMs = awake ? 1 : POWER_IDLE_POLL_MS;
+  int64_t start = esp_timer_get_time();
+  bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs)) > 0;
+  int64_t waited = esp_timer_get_time() - start;
+  waitedUs += waited;
+
+  // Timer wakes are measured as overshoot past the scheduled wake
+  if (!woken && !awake) record(WakeSource::Timer, max((int64_t)0, waited - (int64_t)timeoutMs * 1000));
+}
+
+void PowerManager::handled(WakeSource source) {
+  size_t s = (size_t)source;
+  portENTER_CRITICAL(&wakeMux);
+  int64_t since = pendingUs[s];
+  pendingUs[s] = 0;
+  portEXIT_CRITICAL(&wakeMux);
+  if (since) record(source, esp_timer_get_time() - since);
+}
+
+void PowerManager::record(WakeSource source, int64_t latencyUs) {
+  WakeLatency &l = latency[(size_t)source];
+  l.count++;
+  l.totalUs += latencyUs;
+  if ((uint32_t)latencyUs > l.maxUs) l.maxUs = latencyUs;
+}
+
+String PowerManager::statsJson() const {
+  int64_t elapsed = esp_timer_get_time() - beganUs;
+  String json = "{\"mode\":\"" +
+                String(pmMode == PowerMode::LightSleep         ? "light_sleep"
+                       : pmMode == PowerMode::FrequencyScaling ? "frequency_scaling"
+                                                               : "polling") +
+                "\",\"awake_held\":" + String(awake ? "true" : "false") +
+                ",\"idle_pct\":" + String(elapsed > 0 ? (uint32_t)(waitedUs * 100 / elapsed) : 0) +
+                // Latencies only describe waking from light sleep when they were taken in that mode
+                ",\"latency_from_light_sleep\":" + String(pmMode == PowerMode::LightSleep ? "true" : "false") +
+                ",\"latency\":{";
+  for (size_t s = 0; s < (size_t)WakeSource::Count; s++) {
+    const WakeLatency &l = latency[s];
+    if (s) json += ",";
+    json += "\"" + String(SOURCE_NAMES[s]) + "\":{\"count\":" + String(l.count) +
+            ",\"avg_us\":" + String(l.count ? (uint32_t)(l.totalUs / l.count) : 0) + ",\"max_us\":" + String(l.maxUs) +
+            "}";
+  }
+  json += "}}";
+  return json;
+}
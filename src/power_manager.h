@@ -0,0 +1,54 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <esp_pm.h>
+
+#define POWER_MAX_FREQ_MHZ 240
+#define POWER_MIN_FREQ_MHZ 80    // Keeps APB at 80 MHz so UART baud rates hold while scaled down
+#define POWER_IDLE_POLL_MS 100   // Longest loop() blocks when idle, bounds REST/MQTT pickup latency
+#define POWER_UART_WAKE_EDGES 3  // RX edges that wake the chip from light sleep, those bytes are lost
+
+enum class WakeSource : uint8_t { PIR, Button, Touch, UART, BLE, Timer, Count };
+enum class PowerMode : uint8_t { Polling, FrequencyScaling, LightSleep };
+
+struct WakeLatency {
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+// Lets loop() block between events so the idle task can drop into automatic light sleep.
+// GPIO and UART interrupts wake the loop task and timestamp the event, and the handler
+// that picks it up calls handled() so wake-to-handler latency is tracked per source.
+class PowerManager {
+public:
+  PowerManager();
+
+  void begin(uint8_t pirPin, uint8_t buttonPin, uint8_t touchIrqPin);  // Call from setup(), binds to loop()'s task
+  void stayAwake(bool awake);  // Holds off light sleep while a link that drops bytes in sleep is active
+  void waitForEvent();         // Blocks until an interrupt, or POWER_IDLE_POLL_MS when idle
+  void handled(WakeSource source);
+  void signal(WakeSource source, bool fromIsr);
+
+  PowerMode mode() const { return pmMode; }
+  int64_t idleUs() const { return waitedUs; }
+  String statsJson() const;
+
+private:
+  static void gpioIsr(void *arg);
+  void record(WakeSource source, int64_t latencyUs);
+
+  PowerMode pmMode;
+  bool awake;
+  TaskHandle_t loopTask;
+  esp_pm_lock_handle_t noSleepLock;
+  volatile int64_t pendingUs[(size_t)WakeSource::Count];  // Event time not yet seen by a handler, 0 if none
+  WakeLatency latency[(size_t)WakeSource::Count];
+  int64_t beganUs;
+  int64_t waitedUs;  // Time loop() spent blocked, the window light sleep can use
+};
+
+extern PowerManager powerManager;
+
+#endif  // POWER_MANAGER_H
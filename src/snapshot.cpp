@@ -0,0 +1,212 @@
+#include "snapshot.h"
+#include "stall_monitor.h"
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <esp_rom_crc.h>
+
+static uint8_t chunk[SNAPSHOT_CHUNK];    // Shared by serve and upload, both run on loop()
+static uint8_t rxChunk[SNAPSHOT_CHUNK];  // Drain task only
+
+SnapshotRelay::SnapshotRelay()
+    : task(nullptr), lock(nullptr), state(SnapshotState::Idle), expected(0), received(0), expectedCrc(0), crc(0),
+      checkCrc(false), lastByteAt(0), heapAtStart(0), heapLow(0), stats() {}
+
+void SnapshotRelay::begin() {
+  Serial1.setRxBufferSize(SNAPSHOT_RX_BUFFER);  // Must precede begin()
+  Serial1.begin(SNAPSHOT_BAUD, SERIAL_8N1, SNAPSHOT_RX_PIN, SNAPSHOT_TX_PIN);
+  if (!LittleFS.begin(true)) Serial.println("[Snapshot] LittleFS mount failed");
+
+  lock = xSemaphoreCreateMutex();
+  if (xTaskCreatePinnedToCore(drainTask, "Snapshot", SNAPSHOT_TASK_STACK, this, SNAPSHOT_TASK_PRIORITY, &task, 1) !=
+      pdPASS) {
+    task = nullptr;
+    Serial.println("[Snapshot] Drain task failed to start, draining from loop()");
+  }
+}
+
+void SnapshotRelay::drainTask(void *arg) {
+  SnapshotRelay *relay = (SnapshotRelay *)arg;
+  for (;;) {
+    // Sleeps until expect() wakes it, then checks the link every tick (16KB lasts 80ms at 2Mbaud)
+    ulTaskNotifyTake(pdTRUE, relay->state == SnapshotState::Receiving ? 1 : portMAX_DELAY);
+    relay->drain();
+  }
+}
+
+void SnapshotRelay::request() {
+  stats = SnapshotStats();
+  stats.requestedAt = millis();
+}
+
+void SnapshotRelay::expect(size_t length, uint32_t announcedCrc, bool hasCrc) {
+  if (!lock) return;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (busy()) abort("new snapshot announced");
+  if (length == 0 || length > SNAPSHOT_MAX_SIZE) {
+    Serial.printf("[Snapshot] Rejecting snapshot of %u bytes\n", (unsigned)length);
+    xSemaphoreGive(lock);
+    return;
+  }
+
+  file = LittleFS.open(SNAPSHOT_FILE ".part", "w");
+  if (!file) {
+    Serial.println("[Snapshot] Failed to open snapshot file");
+    xSemaphoreGive(lock);
+    return;
+  }
+  if (!stats.requestedAt) stats.requestedAt = millis();  // K230D pushed one on its own
+  expected = length;
+  received = 0;
+  expectedCrc = announcedCrc;
+  checkCrc = hasCrc;
+  crc = 0;
+  lastByteAt = millis();
+  heapAtStart = ESP.getFreeHeap();
+  heapLow = heapAtStart;
+  state = SnapshotState::Receiving;
+  xSemaphoreGive(lock);
+  if (task) xTaskNotifyGive(task);
+}
+
+void SnapshotRelay::trackHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < heapLow) heapLow = freeHeap;
+}
+
+void SnapshotRelay::abort(const char *reason) {
+  Serial.printf("[Snapshot] Transfer aborted: %s (%u/%u bytes)\n", reason, (unsigned)received, (unsigned)expected);
+  file.close();
+  LittleFS.remove(SNAPSHOT_FILE ".part");
+  // Drop the rest of the image, or it would be read as the start of the next one
+  while (Serial1.available()) Serial1.read();
+  expected = 0;
+  state = SnapshotState::Idle;
+}
+
+void SnapshotRelay::drain() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  while (state == SnapshotState::Receiving && Serial1.available()) {
+    size_t want = min((size_t)Serial1.available(), min(expected - received, sizeof(rxChunk)));
+    size_t got = Serial1.readBytes(rxChunk, want);
+    if (!got) break;
+    if (!stats.firstByteAt) stats.firstByteAt = millis();
+    if (file.write(rxChunk, got) != got) {
+      abort("flash write failed");
+      break;
+    }
+    crc = esp_rom_crc32_le(crc, rxChunk, got);
+    received += got;
+    lastByteAt = millis();
+    trackHeap();
+    if (received == expected) {
+      file.close();
+      stats.completedAt = millis();
+      state = SnapshotState::Complete;  // loop() checks the CRC and publishes it
+    }
+  }
+  if (state == SnapshotState::Receiving && millis() - lastByteAt > SNAPSHOT_TIMEOUT) abort("link stalled");
+  xSemaphoreGive(lock);
+}
+
+bool SnapshotRelay::poll() {
+  if (!task && state == SnapshotState::Receiving) drain();
+  if (state != SnapshotState::Complete) return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool intact = !checkCrc || crc == expectedCrc;
+  if (!intact) {
+    Serial.printf("[Snapshot] CRC %08x, expected %08x\n", crc, expectedCrc);
+    abort("CRC mismatch");
+  } else {
+    LittleFS.remove(SNAPSHOT_FILE);
+    LittleFS.rename(SNAPSHOT_FILE ".part", SNAPSHOT_FILE);
+    stats.bytes = received;
+    stats.peakHeapUsed = heapAtStart - heapLow;
+    stats.crcChecked = checkCrc;
+    expected = 0;
+    state = SnapshotState::Idle;
+    Serial.printf("[Snapshot] %u bytes ready %lums after request\n", (unsigned)received,
+                  stats.completedAt - stats.requestedAt);
+  }
+  xSemaphoreGive(lock);
+  return intact;
+}
+
+bool SnapshotRelay::available() const { return LittleFS.exists(SNAPSHOT_FILE); }
+
+void SnapshotRelay::serve(WebServer &server) {
+  File image = LittleFS.open(SNAPSHOT_FILE, "r");
+  if (!image) {
+    server.send(404, "application/json", "{\"status\":\"fail\", \"error\":\"No snapshot available\"}");
+    return;
+  }
+
+  // Unknown length switches WebServer to chunked transfer encoding
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "image/jpeg", "");
+  size_t n;
+  while ((n = image.read(chunk, sizeof(chunk))) > 0) {
+    server.sendContent((const char *)chunk, n);
+  }
+  server.sendContent("");  // Terminating chunk
+  image.close();
+}
+
+// Hands HTTPClient the file in its own small reads and samples the heap on each one
+class HeapSamplingStream : public Stream {
+public:
+  HeapSamplingStream(File &file, uint32_t &heapLow) : file(file), heapLow(heapLow) {}
+
+  int available() override { return file.available(); }
+  int read() override { return file.read(); }
+  int peek() override { return file.peek(); }
+  void flush() override {}
+  size_t write(uint8_t) override { return 0; }
+  size_t readBytes(char *buffer, size_t length) override {
+    stallMonitor.feed();  // A slow upload is one long loop() pass, but it is making progress
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < heapLow) heapLow = freeHeap;
+    return file.read((uint8_t *)buffer, length);
+  }
+
+private:
+  File &file;
+  uint32_t &heapLow;
+};
+
+bool SnapshotRelay::upload(const String &url, const String &token) {
+  File image = LittleFS.open(SNAPSHOT_FILE, "r");
+  if (!image) return false;
+
+  heapAtStart = ESP.getFreeHeap();
+  heapLow = heapAtStart;
+  unsigned long start = millis();
+
+  HTTPClient http;
+  http.begin(url);
+  http.addHeader("Content-Type", "image/jpeg");
+  http.addHeader("Authorization", "Bearer " + token);
+  http.addHeader("x-upsert", "true");
+  HeapSamplingStream body(image, heapLow);
+  stats.uploadCode = http.sendRequest("PUT", &body, image.size());
+  http.end();
+  image.close();
+
+  stats.uploadMs = millis() - start;
+  stats.uploadPeakHeapUsed = heapAtStart - heapLow;
+  return stats.uploadCode >= 200 && stats.uploadCode < 300;
+}
+
+String SnapshotRelay::statsJson() const {
+  String json = "{\"event\": \"snapshot\"";
+  json += ", \"bytes\": " + String(stats.bytes);
+  json += ", \"press_to_image_ms\": " + String(stats.completedAt ? stats.completedAt - stats.requestedAt : 0);
+  json += ", \"transfer_ms\": " + String(stats.firstByteAt ? stats.completedAt - stats.firstByteAt : 0);
+  json += ", \"peak_heap_bytes\": " + String(stats.peakHeapUsed);
+  json += ", \"upload_ms\": " + String(stats.uploadMs);
+  json += ", \"upload_peak_heap_bytes\": " + String(stats.uploadPeakHeapUsed);
+  json += ", \"upload_code\": " + String(stats.uploadCode);
+  json += ", \"crc_checked\": " + String(stats.crcChecked ? "true" : "false");
+  json += "}";
+  return json;
+}
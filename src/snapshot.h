@@ -0,0 +1,73 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+#include <WebServer.h>
+#include <freertos/semphr.h>
+
+// High-speed data link from the K230D, separate from the JSON control UART
+#define SNAPSHOT_RX_PIN 17
+#define SNAPSHOT_TX_PIN 18
+#define SNAPSHOT_BAUD 2000000
+#define SNAPSHOT_RX_BUFFER 16384  // UART driver ring buffer, filled from the FIFO by ISR
+#define SNAPSHOT_CHUNK 1024       // Bytes moved per step, the only RAM the image passes through
+#define SNAPSHOT_MAX_SIZE 262144  // Reject announcements larger than this
+#define SNAPSHOT_TIMEOUT 5000UL   // Request to first byte, and max gap between bytes
+#define SNAPSHOT_FILE "/snapshot.jpg"
+#define SNAPSHOT_TASK_STACK 4096
+#define SNAPSHOT_TASK_PRIORITY 3  // Above loop(), so a blocking FCM call or upload can't let the ring buffer overflow
+
+struct SnapshotStats {
+  unsigned long requestedAt;  // Doorbell press / intruder event
+  unsigned long firstByteAt;
+  unsigned long completedAt;
+  size_t bytes;
+  size_t peakHeapUsed;  // Free heap drop while the image was moving
+  unsigned long uploadMs;
+  size_t uploadPeakHeapUsed;
+  int uploadCode;
+  bool crcChecked;  // K230D firmware that announces no CRC is trusted on length alone
+};
+
+enum class SnapshotState : uint8_t { Idle, Receiving, Complete };
+
+// Streams a JPEG from the K230D into flash chunk by chunk, then serves or uploads it
+// straight from the file, so the full image is never held in RAM. A dedicated task drains
+// the data link, so the transfer keeps up while loop() is blocked.
+class SnapshotRelay {
+public:
+  SnapshotRelay();
+
+  void begin();
+  void request();                 // Start the press-to-image clock
+  void expect(size_t length, uint32_t crc, bool hasCrc);  // K230D announced a JPEG on the data link
+  bool poll();                    // Returns true once when a received image passed its CRC
+  bool busy() const { return state != SnapshotState::Idle; }
+  bool available() const;
+
+  void serve(WebServer &server);  // Chunked GET /snapshot/latest
+  bool upload(const String &url, const String &token);  // Streaming HTTP PUT
+  String statsJson() const;
+
+private:
+  static void drainTask(void *arg);
+  void drain();                    // Moves what the UART holds into the file, holds lock
+  void abort(const char *reason);  // Callers hold lock
+  void trackHeap();
+
+  TaskHandle_t task;
+  SemaphoreHandle_t lock;  // Guards the transfer state between the drain task and loop()
+  volatile SnapshotState state;
+  File file;
+  size_t expected;
+  size_t received;
+  uint32_t expectedCrc;
+  uint32_t crc;  // CRC-32 of the bytes received so far
+  bool checkCrc;
+  unsigned long lastByteAt;
+  uint32_t heapAtStart;
+  uint32_t heapLow;
+  SnapshotStats stats;
+};
+
+#endif  // SNAPSHOT_H
@@ -0,0 +1,154 @@
+#include "stall_monitor.h"
+#include <esp_task_wdt.h>
+
+#define STALL_RING_MAGIC 0x53544C31UL  // "STL1"
+
+// Survives software resets, watchdog resets and deep sleep, but not power loss
+struct StallRing {
+  uint32_t magic;
+  uint32_t boots;
+  uint32_t head;   // Next slot to write
+  uint32_t total;  // Stalls recorded since the ring was created
+  StallRecord records[STALL_RING_SIZE];
+};
+
+RTC_NOINIT_ATTR static StallRing ring;
+
+StallMonitor stallMonitor;
+
+StallMonitor::StallMonitor()
+    : budgetMs(STALL_BUDGET_MS), tags(), depth(0), passStartMs(0), current(-1), task(nullptr), resetHook(nullptr),
+      hookRan(false) {}
+
+void StallMonitor::begin(uint32_t budget) {
+  budgetMs = budget;
+
+  if (ring.magic != STALL_RING_MAGIC || ring.head >= STALL_RING_SIZE) {
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = STALL_RING_MAGIC;
+  }
+  ring.boots++;
+
+  // A stall that was still open when we went down caused the reset
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool crashed = reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT || reason == ESP_RST_WDT ||
+                 reason == ESP_RST_PANIC;
+  for (size_t i = 0; i < STALL_RING_SIZE; i++) {
+    if (ring.records[i].open) {
+      ring.records[i].open = 0;
+      ring.records[i].reset = crashed;
+    }
+  }
+
+  // Hard backstop: the task watchdog panics (printing a backtrace) and resets the lock
+  esp_task_wdt_init(STALL_HARD_TIMEOUT_S, true);
+  enableLoopWDT();
+
+  // Room for the reset hook's NVS write
+  xTaskCreatePinnedToCore(monitorTask, "StallMonitor", 4096, this, configMAX_PRIORITIES - 2, &task, 0);
+}
+
+void StallMonitor::enter(const char *tag) {
+  uint8_t d = depth;
+  if (d == 0) {
+    passStartMs = millis();
+    if (task) xTaskNotifyGive(task);
+  }
+  if (d < STALL_TAG_DEPTH) tags[d] = tag;
+  depth = d + 1;
+}
+
+void StallMonitor::exit() {
+  if (depth > 0) depth = depth - 1;
+  if (depth == 0) passStartMs = 0;
+}
+
+void StallMonitor::feed() { esp_task_wdt_reset(); }
+
+void StallMonitor::onReset(void (*hook)()) { resetHook = hook; }
+
+void StallMonitor::buildPath(char *out) const {
+  size_t used = 0;
+  uint8_t d = min((uint8_t)depth, (uint8_t)STALL_TAG_DEPTH);
+  out[0] = '\0';
+  for (uint8_t i = 0; i < d && used < STALL_PATH_LEN - 1; i++) {
+    int n = snprintf(out + used, STALL_PATH_LEN - used, i ? ">%s" : "%s", tags[i] ? tags[i] : "?");
+    if (n < 0) break;
+    used += n;
+  }
+}
+
+void StallMonitor::check() {
+  uint32_t start = passStartMs;
+  uint32_t now = millis();
+
+  if (start == 0 || now - start < budgetMs) {
+    // Pass finished (or is within budget): close out the stall we were tracking
+    if (current >= 0) {
+      ring.records[current].open = 0;
+      current = -1;
+    }
+    return;
+  }
+
+  if (current < 0 || ring.records[current].startedMs != start) {
+    // New stall
+    if (current >= 0) ring.records[current].open = 0;
+    current = ring.head;
+    ring.head = (ring.head + 1) % STALL_RING_SIZE;
+    ring.total++;
+    StallRecord &record = ring.records[current];
+    record.boot = ring.boots;
+    record.startedMs = start;
+    record.reset = 0;
+    record.open = 1;
+    hookRan = false;
+  }
+
+  // Keep the duration and stuck point current, in case the watchdog fires next
+  StallRecord &record = ring.records[current];
+  record.durationMs = now - start;
+  buildPath(record.path);
+
+  // The panic can't save anything, so state worth keeping is written while loop() is still stuck
+  if (resetHook && !hookRan && record.durationMs >= (STALL_HARD_TIMEOUT_S - STALL_RESET_WARN_S) * 1000UL) {
+    hookRan = true;
+    resetHook();
+  }
+}
+
+void StallMonitor::monitorTask(void *parameter) {
+  StallMonitor *monitor = (StallMonitor *)parameter;
+  for (;;) {
+    // Sleep while loop() is blocked between events so the monitor doesn't keep the chip out of light sleep
+    if (monitor->passStartMs == 0 && monitor->current < 0) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    vTaskDelay(pdMS_TO_TICKS(STALL_CHECK_MS));
+    monitor->check();
+  }
+}
+
+uint32_t StallMonitor::stallCount() const { return ring.total; }
+
+String StallMonitor::recordsJson() const {
+  String json = "{\"boot\":" + String(ring.boots) + ",\"total\":" + String(ring.total) + ",\"stalls\":[";
+  bool first = true;
+  // Oldest first
+  for (size_t i = 0; i < STALL_RING_SIZE; i++) {
+    const StallRecord &record = ring.records[(ring.head + i) % STALL_RING_SIZE];
+    if (record.boot == 0) continue;
+    if (!first) json += ",";
+    first = false;
+    json += "{\"boot\":" + String(record.boot) + ",\"started_ms\":" + String(record.startedMs) +
+            ",\"duration_ms\":" + String(record.durationMs) + ",\"path\":\"" + String(record.path) +
+            "\",\"open\":" + String(record.open ? "true" : "false") +
+            ",\"reset\":" + String(record.reset ? "true" : "false") + "}";
+  }
+  json += "]}";
+  return json;
+}
+
+void StallMonitor::clear() {
+  current = -1;
+  memset(ring.records, 0, sizeof(ring.records));
+  ring.head = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef STALL_MONITOR_H
+#define STALL_MONITOR_H
+
+#include <Arduino.h>
+
+#define STALL_BUDGET_MS 500       // loop() pass longer than this is recorded as a stall
+#define STALL_HARD_TIMEOUT_S 150  // Task watchdog resets the lock when loop() is stuck this long, above the
+                                  // 120 s TLS handshake timeout, the longest single blocking call
+#define STALL_CHECK_MS 50         // Monitor task period while a loop() pass is running
+#define STALL_RESET_WARN_S 5      // Reset hook runs this long before the watchdog would fire
+#define STALL_RING_SIZE 8         // Records kept in RTC memory
+#define STALL_TAG_DEPTH 6         // Nested handler scopes tracked
+#define STALL_PATH_LEN 64
+
+struct StallRecord {
+  uint32_t boot;        // Boot counter when the stall happened
+  uint32_t startedMs;   // Uptime when the stalled loop() pass began
+  uint32_t durationMs;  // Updated while the stall lasts, final once it clears
+  uint8_t open;         // Still stalled when last seen
+  uint8_t reset;        // The lock reset (watchdog or panic) during this stall
+  char path[STALL_PATH_LEN];  // Handler scopes at the stuck point, e.g. "loop>handleTouch>FCM_Notification"
+};
+
+// Watches loop() from a high-priority task. Handlers mark themselves with STALL_SCOPE. A nested
+// scope costs two stores. The outermost one per pass also reads millis() and notifies the monitor
+// task, a few microseconds once per pass.
+class StallMonitor {
+public:
+  StallMonitor();
+
+  void begin(uint32_t budgetMs = STALL_BUDGET_MS);
+  void enter(const char *tag);
+  void exit();
+  void feed();  // Resets the watchdog from inside a long operation on loop()'s task
+  void onReset(void (*hook)());  // Runs on the monitor task once per stall that nears the watchdog reset
+
+  uint32_t stallCount() const;
+  String recordsJson() const;
+  void clear();
+
+private:
+  static void monitorTask(void *parameter);
+  void check();
+  void buildPath(char *out) const;
+
+  uint32_t budgetMs;
+  const char *volatile tags[STALL_TAG_DEPTH];
+  volatile uint8_t depth;
+  volatile uint32_t passStartMs;  // Set when the outermost scope is entered, 32 bits so the other core never reads half
+  volatile int8_t current;       // Ring index of the stall being tracked, -1 if none
+  TaskHandle_t task;
+  void (*resetHook)();
+  bool hookRan;  // For the stall being tracked
+};
+
+extern StallMonitor stallMonitor;
+
+class StallScope {
+public:
+  explicit StallScope(const char *tag) { stallMonitor.enter(tag); }
+  ~StallScope() { stallMonitor.exit(); }
+};
+
+#define STALL_SCOPE_CONCAT(a, b) a##b
+#define STALL_SCOPE_NAME(line) STALL_SCOPE_CONCAT(stallScope, line)
+#define STALL_SCOPE(tag) StallScope STALL_SCOPE_NAME(__LINE__)(tag)
+
+#endif  // STALL_MONITOR_H
@@ -0,0 +1,92 @@
+#include "wire.h"
+#include "json_pool.h"
+#include <string.h>
+
+const char *wireFormatName(WireFormat format) { return format == WireFormat::MsgPack ? "msgpack" : "json"; }
+
+const char *wireContentType(WireFormat format) {
+  return format == WireFormat::MsgPack ? WIRE_MSGPACK_MIME : WIRE_JSON_MIME;
+}
+
+WireFormat wireDetect(const uint8_t *data, size_t length) {
+  if (!length) return WireFormat::Json;
+  uint8_t first = data[0];
+  bool map = (first & 0xF0) == 0x80 || first == 0xDE || first == 0xDF;  // fixmap, map16, map32
+  return map ? WireFormat::MsgPack : WireFormat::Json;
+}
+
+WireFormat wireAccepts(const char *header) {
+  if (!header) return WireFormat::Json;
+  return strstr(header, WIRE_MSGPACK_MIME) || strstr(header, "application/x-msgpack") ? WireFormat::MsgPack
+                                                                                        : WireFormat::Json;
+}
+
+const JsonDocument &wireFilter(WireMessage message) {
+  static const JsonDocument filters[] = {
+      makeJsonFilter({"status", "name", "emb", "len", "crc", "wire", "acks", "id", "ok"}),
+      makeJsonFilter({"id", "cmd", "pin", "name", "room_id", "url", "size", "sha256", "signature", "version"}),
+      makeJsonFilter({"name", "time", "pin", "settings"}),
+      makeJsonFilter({"status", "request", "user_id", "wifi_ssid", "wifi_pwd", "lock_name", "owner", "pin",
+                      "pairing_code", "token"}),
+  };
+  return filters[(size_t)message];
+}
+
+DeserializationError wireDecode(JsonDocument &doc, const uint8_t *data, size_t length, WireFormat format,
+                                WireMessage message) {
+  DeserializationOption::Filter filter(wireFilter(message));
+  if (format == WireFormat::MsgPack) return deserializeMsgPack(doc, data, length, filter);
+  return deserializeJson(doc, data, length, filter);
+}
+
+size_t wireEncode(JsonVariantConst doc, WireFormat format, uint8_t *out, size_t capacity) {
+  size_t needed = format == WireFormat::MsgPack ? measureMsgPack(doc) : measureJson(doc);
+  if (needed > capacity) return 0;
+  return format == WireFormat::MsgPack ? serializeMsgPack(doc, out, capacity) : serializeJson(doc, out, capacity);
+}
+
+size_t wireFrame(JsonVariantConst doc, uint8_t *out, size_t capacity) {
+  if (capacity < WIRE_FRAME_HEADER) return 0;
+  size_t length = wireEncode(doc, WireFormat::MsgPack, out + WIRE_FRAME_HEADER, capacity - WIRE_FRAME_HEADER);
+  if (!length || length > 0xFFFF) return 0;
+  out[0] = WIRE_FRAME_MARKER;
+  out[1] = length >> 8;
+  out[2] = length & 0xFF;
+  return WIRE_FRAME_HEADER + length;
+}
+
+#ifdef ARDUINO
+// ArduinoJson's String writer appends NUL-terminated chunks, MessagePack needs the length kept
+class BinaryStringWriter {
+public:
+  explicit BinaryStringWriter(String &out) : out(out) {}
+  size_t write(uint8_t c) { return out.concat((const char *)&c, 1) ? 1 : 0; }
+  size_t write(const uint8_t *data, size_t length) { return out.concat((const char *)data, length) ? length : 0; }
+
+private:
+  String &out;
+};
+
+String wireEncode(JsonVariantConst doc, WireFormat format) {
+  String out;
+  BinaryStringWriter writer(out);
+  if (format == WireFormat::MsgPack) {
+    out.reserve(measureMsgPack(doc));
+    serializeMsgPack(doc, writer);
+  } else {
+    out.reserve(measureJson(doc));
+    serializeJson(doc, writer);
+  }
+  return out;
+}
+
+String wireTranscode(const String &json, WireFormat &format) {
+  if (format == WireFormat::Json) return json;
+  PooledJsonDocument doc;
+  if (deserializeJson(doc, json.c_str(), json.length())) {
+    format = WireFormat::Json;
+    return json;
+  }
+  return wireEncode(doc, format);
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_JSON_MIME "application/json"
+#define WIRE_MSGPACK_MIME "application/msgpack"
+#define WIRE_FRAME_MARKER 0xC1  // Never used by MessagePack, so it can't be mistaken for the start of a message
+#define WIRE_FRAME_HEADER 3     // Marker, then payload length as 16-bit big endian
+
+// Every link carries the same messages as JSON text or MessagePack. Old peers only ever
+// send JSON and get JSON back, MessagePack is used once the peer has shown it speaks it.
+enum class WireFormat : uint8_t { Json, MsgPack };
+
+// Inbound message schemas, each decodes through a filter that keeps only its own fields
+enum class WireMessage : uint8_t {
+  K230DStatus,    // match, intruder, embedding, snapshot, awake, ack
+  Command,        // unlock, start_call, end_call, get_stalls, ota over MQTT and POST /command
+  Settings,       // PATCH /update-settings
+  Commissioning,  // BLE commissioning payload, Wi-Fi scan request and IP ack
+  Count
+};
+
+const char *wireFormatName(WireFormat format);
+const char *wireContentType(WireFormat format);
+WireFormat wireDetect(const uint8_t *data, size_t length);  // Sniffs the first byte, JSON starts with '{'
+WireFormat wireAccepts(const char *header);                 // MessagePack if an Accept header lists it
+const JsonDocument &wireFilter(WireMessage message);
+
+DeserializationError wireDecode(JsonDocument &doc, const uint8_t *data, size_t length, WireFormat format,
+                                WireMessage message);
+size_t wireEncode(JsonVariantConst doc, WireFormat format, uint8_t *out, size_t capacity);  // 0 if it didn't fit
+size_t wireFrame(JsonVariantConst doc, uint8_t *out, size_t capacity);  // MessagePack behind a frame header
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+String wireEncode(JsonVariantConst doc, WireFormat format);
+// Re-encodes a hand-built JSON message, falls back to the JSON (and sets format) if it can't be parsed
+String wireTranscode(const String &json, WireFormat &format);
+#endif
+
+#endif  // WIRE_H
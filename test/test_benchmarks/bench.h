@@ -0,0 +1,120 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "heap_accounting.h"
+
+#ifndef BENCH_FIRMWARE
+#define BENCH_FIRMWARE "dev"  // Set from the command line to tag runs, e.g. -DBENCH_FIRMWARE=\"v1.1\"
+#endif
+#define BENCH_MAX_SAMPLES 2048  // Longer runs keep every n-th sample for the percentiles
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define BENCH_ENV "esp32s3"
+#define BENCH_UNIT "cycles"
+#define BENCH_STACK_SIZE 8192  // Each benchmark runs on a fresh task so its stack high-water mark is its own
+
+static inline uint32_t benchNow() { return ESP.getCycleCount(); }
+#else
+#include <chrono>
+
+#define BENCH_ENV "native"
+#define BENCH_UNIT "ns"
+
+static inline uint32_t benchNow() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+struct BenchResult {
+  const char *name;
+  uint32_t iterations;
+  uint32_t min;
+  uint32_t median;
+  uint32_t p99;
+  int32_t heapDelta;   // Free heap lost across the timed iterations, after one warm-up call
+  int32_t stackBytes;  // Peak stack used by the benchmark task, -1 on native
+};
+
+// Times fn over many iterations with the cycle counter (nanoseconds on native)
+static void benchMeasure(const std::function<void()> &fn, BenchResult &result) {
+  uint32_t stride = (result.iterations + BENCH_MAX_SAMPLES - 1) / BENCH_MAX_SAMPLES;
+  std::vector<uint32_t> samples;
+  samples.reserve(result.iterations / stride + 1);
+
+  fn();  // Warm-up: lazy statics and pool slots are set up outside the measurement
+  size_t freeBefore = HeapAccounting::freeBytes();
+  for (uint32_t i = 0; i < result.iterations; i++) {
+    uint32_t start = benchNow();
+    fn();
+    uint32_t elapsed = benchNow() - start;
+    if (i % stride == 0) samples.push_back(elapsed);
+  }
+  result.heapDelta = (int32_t)freeBefore - (int32_t)HeapAccounting::freeBytes();
+
+  std::sort(samples.begin(), samples.end());
+  result.min = samples.front();
+  result.median = samples[samples.size() / 2];
+  result.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+}
+
+#ifdef ARDUINO
+struct BenchJob {
+  const std::function<void()> *fn;
+  BenchResult *result;
+  TaskHandle_t caller;
+};
+
+static void benchTask(void *parameter) {
+  BenchJob *job = (BenchJob *)parameter;
+  benchMeasure(*job->fn, *job->result);
+  job->result->stackBytes = BENCH_STACK_SIZE - uxTaskGetStackHighWaterMark(NULL);  // IDF counts in bytes
+  xTaskNotifyGive(job->caller);
+  vTaskDelete(NULL);
+}
+#endif
+
+// One JSON object per line, so runs from different firmware versions can be diffed
+static void benchReport(const BenchResult &r) {
+  printf("{\"bench\":\"%s\",\"env\":\"%s\",\"fw\":\"%s\",\"unit\":\"%s\",\"iterations\":%u,\"min\":%u,"
+         "\"median\":%u,\"p99\":%u,\"heap_delta\":%d,\"stack_bytes\":%d}\n",
+         r.name, BENCH_ENV, BENCH_FIRMWARE, BENCH_UNIT, (unsigned)r.iterations, (unsigned)r.min, (unsigned)r.median,
+         (unsigned)r.p99, (int)r.heapDelta, (int)r.stackBytes);
+  fflush(stdout);
+}
+
+// Encoded size of one message in both wire formats, reported next to its timings
+static void benchReportBytes(const char *name, size_t jsonBytes, size_t msgpackBytes) {
+  printf("{\"bench\":\"%s\",\"env\":\"%s\",\"fw\":\"%s\",\"unit\":\"bytes\",\"json\":%u,\"msgpack\":%u,"
+         "\"saved_pct\":%u}\n",
+         name, BENCH_ENV, BENCH_FIRMWARE, (unsigned)jsonBytes, (unsigned)msgpackBytes,
+         jsonBytes ? (unsigned)((jsonBytes - msgpackBytes) * 100 / jsonBytes) : 0);
+  fflush(stdout);
+}
+
+static BenchResult bench(const char *name, uint32_t iterations, const std::function<void()> &fn) {
+  BenchResult result = {name, iterations, 0, 0, 0, 0, -1};
+#ifdef ARDUINO
+  BenchJob job = {&fn, &result, xTaskGetCurrentTaskHandle()};
+  xTaskCreatePinnedToCore(benchTask, "bench", BENCH_STACK_SIZE, &job, uxTaskPriorityGet(NULL), NULL,
+                          xPortGetCoreID());
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+  benchMeasure(fn, result);
+#endif
+  benchReport(result);
+  return result;
+}
+
+#endif  // BENCH_H
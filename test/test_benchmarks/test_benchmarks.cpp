@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "battery.h"
+#include "bench.h"
+#include "face_gallery.h"
+#include "heap_accounting.h"
+#include "json_pool.h"
+#include "wire.h"
+
+#ifndef BENCH_SOAK_ITERATIONS
+#define BENCH_SOAK_ITERATIONS 1000000UL  // Messages pushed through the JSON pool by the soak run
+#endif
+
+#ifdef ARDUINO
+#include <TFT_eSPI.h>
+#include "credentials.h"
+
+// Hot paths in main.cpp, linked in with test_build_src
+extern TFT_eSPI tft;
+bool checkPin(const char *);
+void handleK230DMessage(const char *, size_t, WireFormat);
+void mqttCallback(char *, byte *, unsigned int);
+String fcmPayload(const String &, const String &);
+void drawKeypad();
+uint8_t getBatteryLevel();
+#endif
+
+// The host heap hook only sees operator new and ArduinoJson allocates with malloc, so a zero
+// delta on native proves nothing. The check only runs on target.
+#ifdef ARDUINO
+#define ASSERT_NO_HEAP_GROWTH(r) TEST_ASSERT_EQUAL_INT32(0, (r).heapDelta)
+#else
+#define ASSERT_NO_HEAP_GROWTH(r) (void)(r)
+#endif
+
+static volatile uint32_t sink;  // Keeps results alive so the compiler can't drop the work
+
+static const char K230D_MATCH[] = "{\"status\":\"match\",\"name\":\"Alice\",\"confidence\":0.93,\"frame\":1042}";
+static const char MQTT_START_CALL[] = "{\"cmd\":\"start_call\",\"room_id\":\"room-4f2a91\",\"issued_at\":1351824120}";
+
+static uint32_t lcg = 12345;
+static int8_t randomS8() {
+  lcg = lcg * 1664525UL + 1013904223UL;
+  return (int8_t)((lcg >> 24) % 255 - 127);
+}
+
+static void randomEmbedding(int8_t *out) {
+  for (size_t i = 0; i < FACE_EMBEDDING_DIM; i++) out[i] = randomS8();
+}
+
+static void encodeBase64(const uint8_t *data, size_t length, char *out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t o = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = data[i] << 16 | (i + 1 < length ? data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+    out[o++] = alphabet[(chunk >> 18) & 0x3F];
+    out[o++] = alphabet[(chunk >> 12) & 0x3F];
+    out[o++] = i + 1 < length ? alphabet[(chunk >> 6) & 0x3F] : '=';
+    out[o++] = i + 2 < length ? alphabet[chunk & 0x3F] : '=';
+  }
+  out[o] = '\0';
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ==================== Portable hot paths ====================
+void test_harness_overhead() { bench("harness_overhead", 10000, []() { sink = sink + 1; }); }
+
+void test_json_parse_k230d() {
+  static const JsonDocument filter = makeJsonFilter({"status", "name", "emb", "len"});
+  bool ok = true;
+  BenchResult r = bench("json_parse_k230d_match", 10000, [&]() {
+    PooledJsonDocument doc;
+    ok &= !deserializeJson(doc, K230D_MATCH, sizeof(K230D_MATCH) - 1, DeserializationOption::Filter(filter));
+    sink = strlen(doc["name"] | "");
+  });
+  TEST_ASSERT_TRUE(ok);
+  ASSERT_NO_HEAP_GROWTH(r);
+}
+
+void test_json_parse_k230d_embedding() {
+  alignas(16) int8_t embedding[FACE_EMBEDDING_DIM];
+  randomEmbedding(embedding);
+  char line[64 + FACE_EMBEDDING_DIM * 4 / 3 + 4];
+  strcpy(line, "{\"status\":\"embedding\",\"emb\":\"");
+  encodeBase64((const uint8_t *)embedding, FACE_EMBEDDING_DIM, line + strlen(line));
+  strcat(line, "\"}");
+
+  static const JsonDocument filter = makeJsonFilter({"status", "name", "emb", "len"});
+  alignas(16) int8_t decoded[FACE_EMBEDDING_DIM];
+  bool ok = true;
+  bench("json_parse_k230d_embedding", 10000, [&]() {
+    PooledJsonDocument doc;
+    ok &= !deserializeJson(doc, line, strlen(line), DeserializationOption::Filter(filter));
+    ok &= decodeEmbedding(doc["emb"], decoded);
+  });
+  TEST_ASSERT_TRUE(ok);
+  TEST_ASSERT_EQUAL_INT8_ARRAY(embedding, decoded, FACE_EMBEDDING_DIM);
+}
+
+void test_json_parse_mqtt() {
+  static const JsonDocument filter = makeJsonFilter({"cmd", "room_id", "url", "size", "sha256", "version"});
+  bool ok = true;
+  bench("json_parse_mqtt", 10000, [&]() {
+    PooledJsonDocument doc;
+    ok &= !deserializeJson(doc, MQTT_START_CALL, sizeof(MQTT_START_CALL) - 1, DeserializationOption::Filter(filter));
+    ok &= doc["cmd"] == "start_call";
+  });
+  TEST_ASSERT_TRUE(ok);
+}
+
+// Sustained parsing must neither fall back to the heap nor leak
+void test_json_pool_soak() {
+  static const JsonDocument k230dFilter = makeJsonFilter({"status", "name", "emb", "len"});
+  static const JsonDocument mqttFilter = makeJsonFilter({"cmd", "room_id", "url", "size", "sha256", "version"});
+  JsonPoolStats before = JsonDocumentPool::instance().stats();
+  uint32_t n = 0;
+  BenchResult r = bench("json_pool_soak", BENCH_SOAK_ITERATIONS, [&]() {
+    PooledJsonDocument doc;
+    if (n++ & 1) deserializeJson(doc, K230D_MATCH, sizeof(K230D_MATCH) - 1, DeserializationOption::Filter(k230dFilter));
+    else deserializeJson(doc, MQTT_START_CALL, sizeof(MQTT_START_CALL) - 1, DeserializationOption::Filter(mqttFilter));
+  });
+  JsonPoolStats after = JsonDocumentPool::instance().stats();
+  TEST_ASSERT_EQUAL_UINT32(before.fallbacks, after.fallbacks);
+  TEST_ASSERT_LESS_OR_EQUAL(JSON_POOL_SLOT_SIZE, after.highWater);
+  ASSERT_NO_HEAP_GROWTH(r);
+}
+
+// A commissioning payload with a 2KB JWT outgrows its slot and spills to the heap instead of failing
+void test_json_pool_overflow() {
+  static char payload[2200];
+  size_t length = snprintf(payload, sizeof(payload), "{\"user_id\":\"u-1\",\"wifi_ssid\":\"home\",\"token\":\"");
+  for (int i = 0; i < 2048; i++) payload[length++] = 'a' + i % 26;
+  payload[length++] = '"';
+  payload[length++] = '}';
+  JsonPoolStats before = JsonDocumentPool::instance().stats();
+  {
+    PooledJsonDocument doc;
+    TEST_ASSERT_FALSE(wireDecode(doc, (const uint8_t *)payload, length, WireFormat::Json,
+                                 WireMessage::Commissioning));
+    TEST_ASSERT_EQUAL_UINT32(2048, strlen(doc["token"] | ""));
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(before.fallbacks, JsonDocumentPool::instance().stats().fallbacks);
+}
+
+void test_battery_soc() {
+  volatile int cv = 1000;
+  bench("battery_soc", 10000, [&]() {
+    sink = socFromCentivolts(cv);
+    cv = cv >= 1300 ? 1000 : cv + 1;
+  });
+  TEST_ASSERT_EQUAL_UINT8(50, socFromCentivolts(1206));
+}
+
+void test_battery_alarm() {
+  BatteryAlarm alarm;
+  uint8_t level = 100;
+  bench("battery_alarm", 10000, [&]() {
+    sink = alarm.update(level);
+    level = level == 0 ? 100 : level - 1;
+  });
+}
+
+void test_heap_scope() {
+  bench("heap_scope", 10000, []() { HEAP_SCOPE(UI); });
+}
+
+void test_dot_product() {
+  alignas(16) int8_t a[FACE_EMBEDDING_DIM];
+  alignas(16) int8_t b[FACE_EMBEDDING_DIM];
+  randomEmbedding(a);
+  randomEmbedding(b);
+  int32_t expected = 0;
+  for (size_t i = 0; i < FACE_EMBEDDING_DIM; i++) expected += a[i] * b[i];
+
+  bench("dot_product_s8", 10000, [&]() { sink = dotProductS8(a, b, FACE_EMBEDDING_DIM); });
+  TEST_ASSERT_EQUAL_INT32(expected, dotProductS8(a, b, FACE_EMBEDDING_DIM));
+}
+
+static void benchGalleryMatch(const char *name, size_t identities) {
+  FaceGallery gallery;
+  TEST_ASSERT_TRUE(gallery.begin(false));  // Scratch gallery, the enrolled faces on flash are untouched
+  TEST_ASSERT_GREATER_OR_EQUAL(identities, gallery.capacity());
+
+  alignas(16) int8_t probe[FACE_EMBEDDING_DIM];
+  alignas(16) int8_t embedding[FACE_EMBEDDING_DIM];
+  char id[FACE_NAME_LEN];
+  for (size_t i = 0; i < identities; i++) {
+    randomEmbedding(embedding);
+    snprintf(id, sizeof(id), "id%u", (unsigned)i);
+    TEST_ASSERT_TRUE(gallery.enroll(id, embedding));
+    if (i == identities / 2) memcpy(probe, embedding, sizeof(probe));
+  }
+
+  int index = -1;
+  float score = 0;
+  bench(name, 1000, [&]() { index = gallery.match(probe, score); });
+  TEST_ASSERT_EQUAL_INT((int)(identities / 2), index);
+}
+
+void test_gallery_match_10() { benchGalleryMatch("gallery_match_10", 10); }
+void test_gallery_match_100() { benchGalleryMatch("gallery_match_100", 100); }
+void test_gallery_match_1000() { benchGalleryMatch("gallery_match_1000", 1000); }
+
+// One of each message the links carry, outbound ones decode without a schema filter
+struct WireSample {
+  const char *name;
+  const char *json;
+  bool inbound;
+  WireMessage schema;
+};
+
+static const WireSample WIRE_SAMPLES[] = {
+    {"match", K230D_MATCH, true, WireMessage::K230DStatus},
+    {"intruder", "{\"status\":\"intruder\",\"confidence\":0.41,\"frame\":1043}", true, WireMessage::K230DStatus},
+    {"awake", "{\"status\":\"awake\",\"wire\":\"msgpack\"}", true, WireMessage::K230DStatus},
+    {"unlock", "{\"id\":\"6f1c2a90-3b7e-4d15\",\"cmd\":\"unlock\",\"name\":\"Alice\"}", true, WireMessage::Command},
+    {"start_call", MQTT_START_CALL, true, WireMessage::Command},
+    {"end_call", "{\"id\":\"6f1c2a90-3b7e-4d16\",\"cmd\":\"end_call\"}", true, WireMessage::Command},
+    {"settings",
+     "{\"name\":\"Owner\",\"time\":1351824120,\"pin\":\"1234\",\"settings\":{\"motion_sensitivity\":80,"
+     "\"vid_quality\":1024,\"call_timeout\":40,\"snippet_time\":15,\"notify_motion\":true,\"share_analytics\":true}}",
+     true, WireMessage::Settings},
+    {"status",
+     "{\"lock_id\":\"c0ffee00-1234-4abc-9def-9876543210aa\",\"lock_name\":\"Front Door\",\"owner\":\"Owner\","
+     "\"wifi_ssid\":\"Home\",\"battery\":\"87\",\"battery_mv\":12180}",
+     false, WireMessage::Count},
+    {"log", "{\"event\":\"unlock\",\"method\":\"face\",\"success\":\"true\",\"name\":\"Alice\"}", false,
+     WireMessage::Count},
+};
+
+static DeserializationError decodeSample(JsonDocument &doc, const WireSample &sample, const uint8_t *data,
+                                         size_t length, WireFormat format) {
+  if (sample.inbound) return wireDecode(doc, data, length, format, sample.schema);
+  return format == WireFormat::MsgPack ? deserializeMsgPack(doc, data, length) : deserializeJson(doc, data, length);
+}
+
+static void benchWireFormat(const WireSample &sample, JsonVariantConst message, WireFormat format, size_t &bytes) {
+  char name[48];
+  uint8_t encoded[512];
+  snprintf(name, sizeof(name), "wire_encode_%s_%s", wireFormatName(format), sample.name);
+  bench(name, 10000, [&]() { bytes = wireEncode(message, format, encoded, sizeof(encoded)); });
+  TEST_ASSERT_GREATER_THAN(0, bytes);
+  TEST_ASSERT_EQUAL(format, wireDetect(encoded, bytes));
+
+  bool ok = true;
+  snprintf(name, sizeof(name), "wire_decode_%s_%s", wireFormatName(format), sample.name);
+  BenchResult r = bench(name, 10000, [&]() {
+    PooledJsonDocument doc;
+    ok &= !decodeSample(doc, sample, encoded, bytes, format);
+  });
+  TEST_ASSERT_TRUE(ok);
+  ASSERT_NO_HEAP_GROWTH(r);
+}
+
+// Bytes on the link and encode/decode time for every message, JSON against MessagePack
+void test_wire_formats() {
+  for (const WireSample &sample : WIRE_SAMPLES) {
+    JsonDocument message;  // Whole message as sent, the schema filter only applies on decode
+    TEST_ASSERT_FALSE(deserializeJson(message, sample.json));
+
+    size_t jsonBytes = 0, msgpackBytes = 0;
+    benchWireFormat(sample, message, WireFormat::Json, jsonBytes);
+    benchWireFormat(sample, message, WireFormat::MsgPack, msgpackBytes);
+    char name[48];
+    snprintf(name, sizeof(name), "wire_bytes_%s", sample.name);
+    benchReportBytes(name, jsonBytes, msgpackBytes);
+    TEST_ASSERT_LESS_THAN(jsonBytes, msgpackBytes);
+  }
+}
+
+// MessagePack frames on the K230D link must round-trip to the same fields
+void test_wire_frame() {
+  JsonDocument message;
+  TEST_ASSERT_FALSE(deserializeJson(message, K230D_MATCH));
+  uint8_t frame[128];
+  size_t length = wireFrame(message, frame, sizeof(frame));
+  TEST_ASSERT_GREATER_THAN(WIRE_FRAME_HEADER, length);
+  TEST_ASSERT_EQUAL_HEX8(WIRE_FRAME_MARKER, frame[0]);
+  TEST_ASSERT_EQUAL(length - WIRE_FRAME_HEADER, (size_t)(frame[1] << 8 | frame[2]));
+
+  JsonDocument decoded;
+  TEST_ASSERT_FALSE(wireDecode(decoded, frame + WIRE_FRAME_HEADER, length - WIRE_FRAME_HEADER, WireFormat::MsgPack,
+                               WireMessage::K230DStatus));
+  TEST_ASSERT_EQUAL_STRING("match", decoded["status"]);
+  TEST_ASSERT_EQUAL_STRING("Alice", decoded["name"]);
+}
+
+// ==================== On-target hot paths ====================
+#ifdef ARDUINO
+void test_check_pin() {
+  TEST_ASSERT_TRUE(credentials.setPin("1234"));
+  bool ok = true;
+  bench("check_pin", 20, [&]() { ok &= checkPin("1234"); });
+  TEST_ASSERT_TRUE(ok);
+}
+
+void test_session_verify() {
+  String token = credentials.mintSession(0x0200000A);
+  bool ok = true;
+  bench("session_verify", 1000, [&]() { ok &= credentials.verifySession(token, 0x0200000A); });
+  TEST_ASSERT_TRUE(ok);
+}
+
+void test_handle_uart() {
+  // Status the dispatcher doesn't act on, so nothing is unlocked or powered
+  static const char line[] = "{\"status\":\"heartbeat\",\"name\":\"\",\"frame\":1042}";
+  bench("handle_uart", 1000, []() { handleK230DMessage(line, sizeof(line) - 1, WireFormat::Json); });
+}
+
+void test_mqtt_callback() {
+  // Unknown command walks the whole dispatch chain without side effects
+  static char topic[] = "lock/cmd/bench";
+  static const char message[] = "{\"cmd\":\"bench_noop\",\"room_id\":\"room-4f2a91\"}";
+  byte payload[sizeof(message)];
+  bench("mqtt_callback", 1000, [&]() {
+    memcpy(payload, message, sizeof(message));
+    mqttCallback(topic, payload, sizeof(message) - 1);
+  });
+}
+
+void test_fcm_payload() {
+  String title = "Doorbell";
+  String body = "Someone is at the owner's lock!";
+  bench("fcm_payload", 1000, [&]() { sink = fcmPayload(title, body).length(); });
+}
+
+void test_draw_keypad() {
+  tft.init();
+  tft.setRotation(1);
+  bench("draw_keypad", 20, []() { drawKeypad(); });
+}
+
+void test_get_battery_level() {
+  bench("get_battery_level", 10000, []() { sink = getBatteryLevel(); });
+}
+#endif
+
+int runBenchmarks() {
+  UNITY_BEGIN();
+  RUN_TEST(test_harness_overhead);
+  RUN_TEST(test_json_parse_k230d);
+  RUN_TEST(test_json_parse_k230d_embedding);
+  RUN_TEST(test_json_parse_mqtt);
+  RUN_TEST(test_json_pool_soak);
+  RUN_TEST(test_json_pool_overflow);
+  RUN_TEST(test_battery_soc);
+  RUN_TEST(test_battery_alarm);
+  RUN_TEST(test_heap_scope);
+  RUN_TEST(test_dot_product);
+  RUN_TEST(test_gallery_match_10);
+  RUN_TEST(test_gallery_match_100);
+  RUN_TEST(test_gallery_match_1000);
+  RUN_TEST(test_wire_formats);
+  RUN_TEST(test_wire_frame);
+#ifdef ARDUINO
+  RUN_TEST(test_check_pin);
+  RUN_TEST(test_session_verify);
+  RUN_TEST(test_handle_uart);
+  RUN_TEST(test_mqtt_callback);
+  RUN_TEST(test_fcm_payload);
+  RUN_TEST(test_draw_keypad);
+  RUN_TEST(test_get_battery_level);
+#endif
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+  delay(2000);  // Let the test runner attach to the serial port
+  runBenchmarks();
+}
+
+void loop() {}
+#else
+int main() { return runBenchmarks(); }
+#endif